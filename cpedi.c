@@ -5,25 +5,80 @@
 #define _GNU_SOURCE
 
 #include<ctype.h>
+#include<dirent.h>
 #include<errno.h>
 #include<fcntl.h>
-#include<math.h>
+#include<limits.h>
+#include<pthread.h>
+#include<stdatomic.h>
+#include<stdint.h>
 #include<stdio.h>
 #include<stdarg.h>
 #include<stdlib.h>
 #include<string.h>
 #include<sys/ioctl.h>
+#include<poll.h>
+#include<regex.h>
+#include<signal.h>
+#include<spawn.h>
+#include<sys/mman.h>
+#include<sys/resource.h>
+#include<sys/stat.h>
+#include<sys/syscall.h>
 #include<sys/types.h>
+#include<sys/uio.h>
+#include<sys/wait.h>
 #include<termio.h>
 #include<time.h>
 #include<unistd.h>
+#if defined(__SSE2__)
+#include<immintrin.h>
+#endif
 
 /* Defines */
 
 #define CPEDI_VERSION "0.0.2"
 #define CPEDI_TAB_STOP 4
 #define CPEDI_QUIT_TIMES 2
-#define CPEDI_READ_WAIT_TIME 1000
+#define CPEDI_READ_WAIT_TIME 100 // ms to wait for a key before checking on background work
+#define CPEDI_ESC_WAIT_TIME 25 // ms to wait for the rest of an escape sequence
+#define CPEDI_PASTE_WAIT_TIME 1000 // ms to wait for more of a paste
+#define CPEDI_INPUT_BUF 4096
+#define CPEDI_INDEX_CHUNK 65536 // line starts per chunk of the line index
+#define CPEDI_INDEX_PUBLISH (1<<20) // bytes scanned between progress updates
+#define CPEDI_IOV_BATCH 1024 // iovecs per writev() when saving
+#define CPEDI_SAVE_CHUNK (1<<20) // bytes of the mapped file written between progress updates
+#define CPEDI_RUN_GAP 8 // unchanged cells worth resending instead of moving the cursor
+#define CPEDI_SLAB_SIZE (1<<20) // bytes carved into row buffers at a time
+#define CPEDI_SLAB_CLASSES 12 // row buffers of 16, 32, ... 32K bytes come from slabs
+#define CPEDI_SEARCH_CHECK (1<<22) // bytes searched between checks for a key that cancels the scan
+#define CPEDI_LEX_GAP (1<<18) // rows past the lexed ones worth lexing, further down the lexer starts from a guess
+#define CPEDI_LEX_BACK 1024 // rows above the one wanted that the guess starts at
+#define CPEDI_SEARCH_LOAD 4096 // rows of the mapped file loaded at a time while searching
+#define CPEDI_REPLACE_CHUNK 1024 // rows a replace worker takes at a time
+#define CPEDI_REPLACE_THREADS 64 // most workers a replace-all starts
+#define CPEDI_COMPLETIONS 3 // suggestions shown for the identifier at the cursor
+#define CPEDI_COMPLETE_VISIT 4096 // trie nodes looked at for one set of suggestions
+#define CPEDI_IDENT_MAX 64 // longest identifier that gets suggested
+#define CPEDI_UNDO_LIMIT (64<<20) // bytes the undo journal may hold, the oldest edits go first
+#define CPEDI_KILL_RING 8 // cut or copied texts kept for ^V
+#define CPEDI_OSC52_MAX (1<<20) // most bytes sent to the terminal clipboard
+#define CPEDI_CXX "g++"
+#define CPEDI_CXXFLAGS "-std=c++17 -O2 -Wall -Wextra"
+#define CPEDI_CC "cc"
+#define CPEDI_CFLAGS "-std=c11 -O2 -Wall -Wextra"
+#define CPEDI_CACHE_KEEP 64 // binaries kept in the build cache, the ones used longest ago go first
+#define CPEDI_PANE_ROWS 8 // rows the message pane takes from the text
+#define CPEDI_PANE_LINES 5000 // lines of compiler output kept, the rest is dropped
+#define CPEDI_TEST_TIME 2 // cpu seconds a sample test may take
+#define CPEDI_TEST_MEMORY 256 // megabytes a sample test may keep resident
+#define CPEDI_TEST_THREADS 64 // most tests run at once
+#define CPEDI_STRESS_GEN "gen" // generator next to the file, gen.cpp or gen.c, called with a seed
+#define CPEDI_STRESS_BRUTE "brute" // slow but trusted solution next to the file
+#define CPEDI_STRESS_REPORT 250 // ms between throughput updates
+#define CPEDI_STRESS_LINES 2 // lines of the failing input and of its answer shown in the pane
+#define CPEDI_BENCH_LINES 200000 // lines in the file the benchmark opens, scrolls and saves
+#define CPEDI_BENCH_SIZE "24x80" // screen the benchmark draws on
 
 #define CTRL_KEY(k) ((k) & 0x1f) // sets the upper 3 bits of the character to 0
 
@@ -37,32 +92,176 @@ enum editorKey {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN 
+    PAGE_DOWN,
+    NO_KEY, // nothing was pressed, but the screen should be redrawn
+    PASTE_BEGIN, // <esc>[200~, the terminal starts sending a paste
+    PASTE_KEY // a whole paste was read, its text is in I.paste
+};
+
+// how a screen cell is drawn
+enum cellAttr {
+    ATTR_NORMAL = 0,
+    ATTR_INVERSE,
+    ATTR_MATCH, // a search match that is not the current one
+    ATTR_KEYWORD,
+    ATTR_TYPE,
+    ATTR_NUMBER,
+    ATTR_STRING,
+    ATTR_COMMENT,
+    ATTR_PREPROC,
+    ATTR_BRACKET, // the brackets around the cursor
+    ATTR_ERROR // a compiler error in the message pane
+};
+
+// where the C++ lexer is at the end of a row
+enum lexState {
+    LEX_NORMAL = 0,
+    LEX_COMMENT, // inside /* */
+    LEX_PREPROC // a directive continued with a backslash
 };
 
 /* Data */
 
+// start offsets of the lines of a mapped file, filled in by a background thread
+struct lineIndex
+{
+    const char *map;
+    size_t len;
+    uint64_t **chunks; // chunks[k/CPEDI_INDEX_CHUNK][k%CPEDI_INDEX_CHUNK] => start of line k+1
+    size_t nchunks;
+    atomic_size_t nlines; // newlines found so far, their entries are ready to read
+    atomic_size_t scanned; // bytes scanned so far
+    atomic_int done;
+    atomic_int failed; // ran out of memory and stopped, nlines is all it found
+    atomic_int stop;
+    pthread_t thread;
+};
+
+// header of a row buffer too big for the slabs, they are kept in a list
+struct bigBlock
+{
+    struct bigBlock *prev, *next;
+};
+
+// where the row buffers of one file come from, all of them are released at once
+struct rowArena
+{
+    char *free[CPEDI_SLAB_CLASSES]; // freed blocks of 16<<k bytes, linked through their first bytes
+    char **slabs;
+    int nslabs, slabcap;
+    char *bump; // unused end of the newest slab
+    size_t bumpleft;
+    struct bigBlock *big;
+    size_t allocs, frees; // row buffers handed out and given back
+    size_t mallocs; // slabs and big buffers taken from malloc
+};
+
+// a row buffer and the size it was allocated with
+struct rowBlock
+{
+    char *p;
+    int cap;
+};
+
+// brackets of a run of rows, opening ones count +1 and closing ones -1
+struct bracketSum
+{
+    int sum;
+    int minpre; // lowest running sum from the start, 0 for none
+    int maxsuf; // highest sum of a tail, 0 for none
+};
+
+// a tab in a row and the render column right after it
+struct tabStop
+{
+    int cx, rx;
+};
+
 typedef struct erow // editor row
 {
     int size;
-    int rsize; // size of contents of render
+    int rsize; // size of the row as drawn
+    int cap; // bytes allocated for chars, 0 => chars points into the mapped file
+    int rcap; // bytes allocated for render
+    int ntabs; // entries of tabs
+    int tabcap; // bytes allocated for tabs
+    int hlcap; // bytes allocated for hl
+    unsigned char stale; // chars changed or was never looked at, rsize and render are out of date
+    unsigned char shared; // chars is in the snapshot of a running save, copy it before changing it
+    unsigned char indexed; // tabs is up to date, kept that way by the row operations
+    unsigned char hlin, hlout; // lexer state at the start and the end of the row
+    unsigned char hlknown; // hlout was lexed from the current chars starting in hlin
+    unsigned char hlready; // hl was filled in by that same lexing
+    unsigned char words; // identifiers of chars are in the trie, rows a jump went past get there once drawn
+    unsigned char skipped; // loaded by a jump that went past it, the lexer may start below it
     char* chars;
-    char* render;
+    char* render; // chars with the tabs expanded, NULL if there are none => draw chars
+    struct tabStop *tabs; // tabs of chars in order, indexed by editorRowIndexTabs()
+    unsigned char *hl; // cellAttr of every byte of the row as drawn, only for rows that were drawn
+    struct bracketSum br; // brackets outside of comments and strings, as of the last lexing
 } erow;
 
+// a row as it was when the save started
+struct saveLine
+{
+    const char *chars;
+    size_t len;
+};
+
+// a save running in the background, the thread only touches the job
+struct saveJob
+{
+    struct saveLine *lines;
+    int nlines;
+    const char *tail; // lines of the mapped file that are not rows yet, written as they are
+    size_t taillen;
+    char *target; // file that gets replaced
+    mode_t mode;
+    size_t total; // bytes to write
+    atomic_size_t written;
+    atomic_int done;
+    int err; // errno of the step that failed, 0 once the file is saved
+    int dirty; // E.dirty when the snapshot was taken
+    int threaded; // thread has to be joined
+    pthread_t thread;
+};
 
 struct editorConfig
 {
     int cx, cy; // position of cursor => zero based indexing => index into chars field of an erow
-    int rx; // index into the render field
+    int rx; // index into the render field, the gutter is not part of it
     int rowoff; // refers to what’s at the top of the screen => zero based
     int coloff; // refers to what's at the left of the screen=> zero based
     int screenrows; // rows in the terminal => 1 based indexing
     int screencols; // cols in the terminal => 1 based indexig
     int numrows; // number of rows in the file
-    erow *row; // array of rows
+    erow *row; // gap buffer of rows => index it through editorRowAt()
+    int rowcap; // slots allocated in row
+    int rowgap; // index where the gap starts, it is rowcap-numrows slots long
     int dirty; // keep track if file is modified
     char *filename;
+    char *map; // file mapped by editorOpen, unedited rows are views into it
+    size_t maplen;
+    size_t mapoff; // offset of the first line that is not a row yet
+    size_t mapline; // line number of the line at mapoff
+    struct lineIndex *index;
+    size_t indexseen; // bytes indexed when the screen was last drawn
+    int txdepth; // nesting of editorBeginEdit()
+    int txlo, txhi; // range of rows that may be stale
+    int txmoved; // first row moved by an insert or delete, -1 if none
+    int txdirty; // the transaction changed the buffer
+    int syntax; // highlight the buffer as C++
+    int hlvalid; // rows before it have known lexer states
+    int hltop; // rows before it were lexed, those past hlvalid are still right unless edited
+    int hldirty; // last row edited since, -1 if none
+    int hlguess; // past hlvalid, rows from it were lexed starting in LEX_NORMAL as a guess, -1 if none
+    int hlfar; // rows before it from hlguess on have end states from that guess
+    struct saveJob *save; // save in progress
+    struct rowBlock *graveyard; // chars replaced while the save still reads them
+    int ngrave, gravecap;
+    struct rowArena arena;
+    size_t openallocs; // row buffers allocated while opening the file
+    size_t keyallocs; // row buffers allocated by the last key
     char statusmsg[80];
     time_t statusmsg_time;
     struct termios orig_termios; // config of orginal terminal   
@@ -70,11 +269,385 @@ struct editorConfig
 
 struct editorConfig E;
 
+// how the text area is laid out, only changes when the line numbers need another digit
+struct editorLayout
+{
+    int gutter; // columns taken by the line numbers
+    int grow; // E.numrows that needs a wider gutter
+    char num[16]; // line numbers are formatted here
+};
+
+struct editorLayout L;
+
+typedef struct scell // screen cell
+{
+    char ch;
+    unsigned char attr;
+} scell;
+
+struct screenFrame
+{
+    int rows, cols; // whole terminal, bars included
+    scell *front; // what the terminal is showing
+    scell *back; // the frame being drawn
+    unsigned char *dirty; // text lines of back that have to be rebuilt
+    int rowoff, coloff, gutter; // viewport the text lines of back were drawn for
+    int valid; // front matches the terminal
+    int canscroll; // terminal understands scroll regions
+    char scrollseq[48]; // scroll to send before the next flush
+    int scrolllen;
+};
+
+struct screenFrame S;
+
+struct inputBuffer
+{
+    unsigned char buf[CPEDI_INPUT_BUF];
+    int len, pos; // bytes in buf, bytes already decoded
+    char *paste; // text of the last bracketed paste
+    size_t pastelen, pastecap;
+    int wake[2]; // background threads write to wake[1] to end the wait for a key
+    int woken;
+};
+
+struct inputBuffer I;
+
+// stands in for the terminal when the editor runs without one: keys come
+// from memory and frames are only counted
+struct headless
+{
+    int on;
+    int rows, cols; // the screen size getWindowSize reports
+    const char *keys; // not handed to the input buffer yet
+    size_t keylen;
+    size_t bytes; // written to the terminal so far
+    int writes; // one per frame, a frame is flushed in one write
+};
+
+struct headless H;
+
+// incremental search started by Ctrl-F
+struct searchState
+{
+    int active; // the prompt is open, matches get highlighted
+    char *query;
+    size_t len;
+    int row, col; // current match, row is -1 if there is none
+    int scanrow; // where a scan that a key interrupted stopped, -1 if none
+    int scandir;
+    size_t scantail; // or the offset in the mapped file it stopped at, going back, 0 if none
+    int cx, cy, rowoff, coloff; // where the cursor was before the search
+};
+
+struct searchState F;
+
+// Segment tree of the bracket sums of the slots of E.row, slots in the gap
+// count as empty. Leaves are node[size+slot], node[1] covers everything.
+struct bracketTree
+{
+    struct bracketSum *node;
+    int size;
+};
+
+struct bracketTree B;
+
+// brackets of one row and the pair around the cursor
+struct bracketList
+{
+    int *cols;
+    int n, cap;
+};
+
+struct bracketPair
+{
+    int orow, ocol; // the opening bracket, orow -1 if there is none
+    int crow, ccol; // its closing one, crow -1 if it has none
+};
+
+struct bracketPair BP;
+
+// identifiers of the buffer with how often they occur, children of a node
+// are a linked list of siblings
+struct trieNode
+{
+    int child, next; // index of the first child and of the next sibling, 0 for none
+    int count; // occurrences of the identifier ending here
+    int below; // occurrences of identifiers in this subtree
+    char c;
+};
+
+struct wordTrie
+{
+    struct trieNode *node; // node[0] is the root
+    int n, cap;
+};
+
+struct wordTrie T;
+
+// completions for the identifier in front of the cursor
+struct completion
+{
+    char word[CPEDI_COMPLETIONS][CPEDI_IDENT_MAX+1];
+    int count[CPEDI_COMPLETIONS];
+    int n;
+    int prefix; // length of the identifier typed so far
+    int shown; // the message bar shows them
+};
+
+struct completion C;
+
+// a row a replace-all rewrote, applied by the main thread
+struct rowEdit
+{
+    int row;
+    char *chars;
+    int len;
+};
+
+// what the workers of one replace-all share, each chunk of rows has its own edits
+struct replaceJob
+{
+    const char *pattern;
+    const char *with;
+    int nchunks;
+    atomic_int next; // next chunk to take
+    struct rowEdit **edits;
+    int *nedits;
+    atomic_long count; // matches replaced
+};
+
+enum undoKind
+{
+    UNDO_SPLICE, // bytes of a row replaced
+    UNDO_INSERT_ROWS,
+    UNDO_DELETE_ROWS,
+    UNDO_SET_ROWS // whole rows given new text in place
+};
+
+// one change in the undo journal, the bytes it carries follow it
+struct undoOp
+{
+    int prev; // bytes back to the record before
+    int group; // the records of one key share it
+    int kind; // undoKind
+    int back; // the deleted bytes are in reverse order, they were a run of backspaces
+    int row, at;
+    int dlen, ilen; // splice: bytes deleted and inserted at chars[at], the deleted ones come first
+    int count; // rows: rows inserted or deleted at row, each as an int length and its bytes,
+               // or rows set, each as its int index, old and new length and both texts
+    int bytes; // bytes carried
+    int bcx, bcy; // cursor before the key
+    int acx, acy; // cursor after it
+};
+
+// records are appended to one buffer 8 byte aligned, the oldest are dropped
+// from its front and the buffer is compacted when that leaves room
+struct undoLog
+{
+    char *log;
+    long cap;
+    long start, end; // records live in log[start..end)
+    long last; // newest record, -1 if there is none
+    long top; // newest record that is applied, the ones after it can be redone
+    int group; // of the current key
+    int touch; // group that last wrote to the newest record
+    int touched; // the current key wrote a record
+    int lost; // group that did not fit, nothing of it is recorded
+    int bcx, bcy; // cursor when the current key started
+    int mute; // edits are not recorded
+};
+
+struct undoLog U;
+
+// texts cut and copied inside the editor, and the helper that hands the
+// newest one to the system clipboard
+struct clipboard
+{
+    char *ring[CPEDI_KILL_RING];
+    size_t ringlen[CPEDI_KILL_RING];
+    int head; // newest entry
+    int n; // entries in use
+    int append; // the last key cut a row, the next cut joins its entry
+    int unsent; // the newest entry is not on the system clipboard yet
+    int yank; // entry the last key pasted, -1 if it did not paste
+    long yanktop; // U.top right after that paste
+    int helper; // index into CPEDI_CLIPBOARD_HELPERS that started last time, -1 if none did
+    pid_t pid; // helper being fed or not yet reaped, 0 if none
+    int fd; // pipe to its stdin, -1 once everything is written
+    char *buf; // what it is fed, kept until it exits in case it fails
+    size_t len, off;
+    pid_t *reap; // helpers replaced by a newer copy, not reaped yet
+    int nreap, reapcap;
+};
+
+struct clipboard K;
+
+// lines shown under the status bar, for now the output of the compiler
+struct messagePane
+{
+    char **lines;
+    unsigned char *attrs; // cellAttr of each line
+    int n, cap;
+    int rows; // rows taken from the text area, 0 when closed
+    int top; // first line shown
+    int follow; // keep the newest lines in view
+    int mark; // line shown inverted, -1 for none
+};
+
+struct messagePane P;
+
+// a compiler run in the background, the thread only touches the job
+struct compileJob
+{
+    char **argv;
+    char *source; // the buffer as it was when the compile started
+    size_t len;
+    char *target; // cached binary, written to tmp first
+    char *tmp;
+    pthread_mutex_t lock; // guards out
+    char *out; // what the compiler printed so far
+    size_t outlen, outcap;
+    atomic_int pid; // of the compiler once it runs
+    atomic_int cancel;
+    atomic_int done;
+    int ok;
+    pthread_t thread;
+};
+
+// an error or warning the compiler reported for a line of the buffer
+struct diagnostic
+{
+    int line, col;
+    int pane; // its line in the message pane, -1 if the pane was full
+};
+
+struct compileState
+{
+    struct compileJob *job;
+    size_t seen; // bytes of job->out already in the pane
+    char *partial; // a line of output that did not end yet
+    size_t partlen;
+    struct timespec start;
+    struct diagnostic *diags;
+    int ndiags, diagcap, errors;
+    int next; // diagnostic ^G goes to next
+    char *binary; // built from the buffer, NULL until a build succeeds
+    uint64_t hash; // of the source and command it was built from
+    void (*then)(); // runs once the compile succeeds
+};
+
+struct compileState M;
+
+enum testVerdict {
+    TEST_RUNNING = 0,
+    TEST_AC, // output matches
+    TEST_WA, // output differs
+    TEST_RAN, // there is no .out to compare with
+    TEST_TLE,
+    TEST_MLE,
+    TEST_RE, // crashed or exited with an error
+    TEST_FAIL // could not be started
+};
+
+// a *.in file next to the source and what running the binary on it gave
+struct sampleTest
+{
+    char *name;
+    char *in;
+    char *out; // expected output, NULL if there is none
+    int verdict; // testVerdict
+    double cpu, wall; // seconds
+    long rss; // peak resident KB
+    atomic_int pid; // while it runs
+    atomic_int done;
+    int shown; // the pane has its result
+};
+
+// the tests of one Ctrl-T, run by a pool of threads
+struct testRun
+{
+    struct sampleTest *tests;
+    int ntests, nshown;
+    char *binary;
+    atomic_int next; // next test to take
+    atomic_int cancel;
+    pthread_t threads[CPEDI_TEST_THREADS];
+    int nthreads;
+    int running;
+    struct timespec start;
+};
+
+struct testRun R;
+
+// a thread of a stress run, t describes the program it is running
+struct stressWorker
+{
+    pthread_t thread;
+    struct sampleTest t;
+};
+
+// one Ctrl-K: the generator feeds the brute force and the buffer's binary
+// until their answers differ
+struct stressRun
+{
+    char *gensrc, *brutesrc;
+    char *gen, *brute, *binary; // built programs
+    char *dir, *stem; // the failing case is written next to the file
+    atomic_int next; // next seed
+    atomic_int runs; // seeds that passed
+    atomic_int stop; // a worker found a failure
+    atomic_int cancel; // ^K again or the buffer went away
+    atomic_int live; // workers still going
+    atomic_int built; // gen and brute are ready, start is set
+    atomic_int done;
+    pthread_mutex_t lock; // guards job and the failure below
+    struct compileJob *job; // building gen or brute
+    int failed; // smallest failing seed, -1 if none
+    char *input, *expected;
+    size_t inputlen, expectedlen;
+    char why[256];
+    struct stressWorker workers[CPEDI_TEST_THREADS];
+    int nworkers;
+    pthread_t thread; // builds gen and brute, then runs the workers
+    int running;
+    double start, secs, reported;
+};
+
+struct stressRun X;
+
 /* prototypes */
+void die(const char *s);
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
-char *editorPrompt(char *prompt);
-char* editorRowsToString(int *buflen);
+char *editorPrompt(char *prompt, void (*callback)(char *, int));
+char* editorRowsToString(size_t *buflen);
+void editorOpenTemplate();
+void editorScroll();
+void screenMarkAllDirty();
+void screenMarkRowDirty(int filerow);
+void screenMarkRowsDirtyFrom(int filerow);
+void editorBury(char *chars, int cap);
+int editorTotalRows();
+void bracketTreeSet(int slot, struct bracketSum b);
+void bracketTreeRefresh(int lo, int hi);
+void bracketTreeBuild();
+void editorRowLearnWords(erow *row, int at, int len);
+void editorRowForgetWords(erow *row, int at, int len);
+void editorIndexWords();
+void undoSplice(erow *row, int at, const char *del, int dlen, const char *ins, int ilen);
+void undoRows(int kind, int at, char **lines, size_t *lens, int count);
+int undoSetRows(struct rowEdit *edits, int count);
+int clipboardFd();
+int clipboardBusy();
+void clipboardService();
+void clipboardFlush();
+void editorCheckCompile();
+void compileStop();
+void editorCheckTests();
+void testsStop();
+void testsStart();
+void editorCheckStress();
+void stressStop();
 
 /* Math */
 int imin(int a, int b){
@@ -87,22 +660,505 @@ int imax(int a, int b){
     return a;
 }
 
-int countDigits(int a){
-    static int maxDigit = 0;
-    int digits = floor( log10( (double)a ) ) + 1;
-    maxDigit = imax(maxDigit, digits);
-    return maxDigit;
+/* Layout */
+
+// The gutter is as wide as the most rows seen so far need, and never less
+// than the screen does. It is only recomputed when E.numrows reaches the next
+// power of ten.
+
+void layoutInit(int rows){
+    L.gutter = 1;
+    L.grow = 10;
+    while (rows >= L.grow && L.gutter < 9){
+        L.gutter++;
+        L.grow *= 10;
+    }
+}
+
+// E.numrows changed
+void layoutUpdate(){
+    if (E.numrows < L.grow) return;
+    layoutInit(imax(E.numrows, L.grow));
+}
+
+/* Line Index */
+
+// bitmask of the '\n' bytes among the 64 bytes at p
+static inline uint64_t newlineMask64(const char *p){
+#if defined(__AVX2__)
+    __m256i nl = _mm256_set1_epi8('\n');
+    uint64_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl));
+    uint64_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p+32)), nl));
+    return lo | (hi << 32);
+#elif defined(__SSE2__)
+    __m128i nl = _mm_set1_epi8('\n');
+    uint64_t mask = 0;
+    int i;
+    for (i = 0; i < 4; i++){
+        uint64_t m = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+16*i)), nl));
+        mask |= m << (16*i);
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    int i;
+    for (i = 0; i < 64; i++){
+        if (p[i] == '\n') mask |= (uint64_t)1 << i;
+    }
+    return mask;
+#endif
+}
+
+// 0 if there is no memory for another chunk
+static int lineIndexAdd(struct lineIndex *ix, size_t k, uint64_t start){
+    size_t c = k / CPEDI_INDEX_CHUNK;
+    if (ix->chunks[c] == NULL){
+        ix->chunks[c] = malloc(sizeof(uint64_t)*CPEDI_INDEX_CHUNK);
+        if (ix->chunks[c] == NULL) return 0;
+    }
+    ix->chunks[c][k % CPEDI_INDEX_CHUNK] = start;
+    return 1;
+}
+
+void *lineIndexThread(void *arg){
+    struct lineIndex *ix = arg;
+    size_t off = 0, k = 0;
+    while (off < ix->len && !atomic_load(&ix->stop)){
+        size_t end = off + CPEDI_INDEX_PUBLISH;
+        if (end > ix->len) end = ix->len;
+        for (; off + 64 <= end; off += 64){
+            uint64_t mask = newlineMask64(&ix->map[off]);
+            while (mask){
+                if (!lineIndexAdd(ix, k, off + __builtin_ctzll(mask) + 1)) goto failed;
+                k++;
+                mask &= mask - 1;
+            }
+        }
+        for (; off < end; off++){
+            if (ix->map[off] != '\n') continue;
+            if (!lineIndexAdd(ix, k, off + 1)) goto failed;
+            k++;
+        }
+        // entries are written before the count that makes them visible
+        atomic_store(&ix->nlines, k);
+        atomic_store(&ix->scanned, off);
+    }
+    atomic_store(&ix->done, 1);
+    return NULL;
+failed:
+    // the lines found so far stay usable, the rest is read the slow way
+    atomic_store(&ix->nlines, k);
+    atomic_store(&ix->failed, 1);
+    atomic_store(&ix->done, 1);
+    return NULL;
+}
+
+struct lineIndex *lineIndexStart(const char *map, size_t len){
+    struct lineIndex *ix = calloc(1, sizeof(struct lineIndex));
+    if (ix == NULL) return NULL;
+    ix->map = map;
+    ix->len = len;
+    ix->nchunks = len/CPEDI_INDEX_CHUNK + 1; // a file has at most len newlines
+    ix->chunks = calloc(ix->nchunks, sizeof(uint64_t *));
+    if (ix->chunks == NULL || pthread_create(&ix->thread, NULL, lineIndexThread, ix) != 0){
+        free(ix->chunks);
+        free(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+void lineIndexFree(struct lineIndex *ix){
+    if (ix == NULL) return;
+    atomic_store(&ix->stop, 1);
+    pthread_join(ix->thread, NULL);
+    size_t c;
+    for (c = 0; c < ix->nchunks; c++) free(ix->chunks[c]);
+    free(ix->chunks);
+    free(ix);
+}
+
+// start offset of line k, if the indexer got that far already
+int lineIndexStartOf(struct lineIndex *ix, size_t k, size_t *start){
+    if (k == 0){
+        *start = 0;
+        return 1;
+    }
+    if (ix == NULL || k > atomic_load(&ix->nlines)) return 0;
+    *start = ix->chunks[(k-1) / CPEDI_INDEX_CHUNK][(k-1) % CPEDI_INDEX_CHUNK];
+    return 1;
+}
+
+// lines in the file, or the ones found so far while indexing
+size_t lineIndexLines(struct lineIndex *ix){
+    size_t lines = atomic_load(&ix->nlines);
+    // a last line without '\n' still counts
+    if (atomic_load(&ix->done) && !atomic_load(&ix->failed) && ix->len > 0 && ix->map[ix->len-1] != '\n') lines++;
+    return lines;
+}
+
+/* Row Allocator */
+
+// Row buffers are blocks of a power of two size carved out of big slabs, a
+// freed block goes on the free list of its size. Growing a row moves it to
+// the next size up, so a line being typed is copied O(log n) times. Closing
+// the file gives back every slab at once instead of each row one by one.
+
+static int arenaClass(size_t need){
+    int k = 0;
+    while (((size_t)16 << k) < need) k++;
+    return k;
+}
+
+// a buffer of at least need bytes, *cap gets the size it really has
+char *arenaAlloc(struct rowArena *a, size_t need, int *cap){
+    a->allocs++;
+    int k = arenaClass(need);
+    if (k >= CPEDI_SLAB_CLASSES){
+        struct bigBlock *b = malloc(sizeof(struct bigBlock) + need);
+        if (b == NULL) die("arenaAlloc: out of memory");
+        a->mallocs++;
+        b->prev = NULL;
+        b->next = a->big;
+        if (a->big) a->big->prev = b;
+        a->big = b;
+        *cap = need;
+        return (char *)(b+1);
+    }
+    size_t size = (size_t)16 << k;
+    *cap = size;
+    char *p = a->free[k];
+    if (p){
+        memcpy(&a->free[k], p, sizeof(char *));
+        return p;
+    }
+    if (a->bumpleft < size){
+        // what is left of the old slab goes to the free lists of smaller blocks
+        int j;
+        for (j = k-1; j >= 0; j--){
+            size_t bsize = (size_t)16 << j;
+            if (a->bumpleft < bsize) continue;
+            memcpy(a->bump, &a->free[j], sizeof(char *));
+            a->free[j] = a->bump;
+            a->bump += bsize;
+            a->bumpleft -= bsize;
+        }
+        if (a->nslabs == a->slabcap){
+            a->slabcap = imax(16, a->slabcap*2);
+            a->slabs = realloc(a->slabs, sizeof(char *)*a->slabcap);
+            if (a->slabs == NULL) die("arenaAlloc: out of memory");
+        }
+        a->bump = malloc(CPEDI_SLAB_SIZE);
+        if (a->bump == NULL) die("arenaAlloc: out of memory");
+        a->mallocs++;
+        a->slabs[a->nslabs++] = a->bump;
+        a->bumpleft = CPEDI_SLAB_SIZE;
+    }
+    p = a->bump;
+    a->bump += size;
+    a->bumpleft -= size;
+    return p;
+}
+
+void arenaFree(struct rowArena *a, char *p, int cap){
+    if (p == NULL || cap == 0) return;
+    a->frees++;
+    int k = arenaClass(cap);
+    if (k >= CPEDI_SLAB_CLASSES){
+        struct bigBlock *b = (struct bigBlock *)p - 1;
+        if (b->prev) b->prev->next = b->next;
+        else a->big = b->next;
+        if (b->next) b->next->prev = b->prev;
+        free(b);
+        return;
+    }
+    memcpy(p, &a->free[k], sizeof(char *));
+    a->free[k] = p;
+}
+
+// give back every row buffer of the arena
+void arenaRelease(struct rowArena *a){
+    int j;
+    for (j = 0; j < a->nslabs; j++) free(a->slabs[j]);
+    free(a->slabs);
+    while (a->big){
+        struct bigBlock *next = a->big->next;
+        free(a->big);
+        a->big = next;
+    }
+    memset(a, 0, sizeof(struct rowArena));
+}
+
+/* Bracket Tree */
+
+static struct bracketSum bracketJoin(struct bracketSum a, struct bracketSum b){
+    struct bracketSum r;
+    r.sum = a.sum + b.sum;
+    r.minpre = imin(a.minpre, a.sum + b.minpre);
+    r.maxsuf = imax(b.maxsuf, b.sum + a.maxsuf);
+    return r;
+}
+
+// bracket sums of what is in the slot, a slot in the gap has none
+static struct bracketSum bracketSlot(int slot){
+    int gaplen = E.rowcap - E.numrows;
+    if (slot >= E.rowcap || (slot >= E.rowgap && slot < E.rowgap + gaplen)){
+        return (struct bracketSum){0, 0, 0};
+    }
+    return E.row[slot].br;
+}
+
+void bracketTreeBuild(){
+    free(B.node);
+    B.size = 1;
+    while (B.size < E.rowcap) B.size *= 2;
+    B.node = calloc(2*B.size, sizeof(struct bracketSum));
+    if (B.node == NULL) die("bracketTreeBuild: out of memory");
+    int j;
+    for (j = 0; j < E.rowcap; j++) B.node[B.size+j] = bracketSlot(j);
+    for (j = B.size-1; j > 0; j--) B.node[j] = bracketJoin(B.node[2*j], B.node[2*j+1]);
+}
+
+void bracketTreeSet(int slot, struct bracketSum b){
+    if (B.node == NULL) return;
+    int j = B.size + slot;
+    B.node[j] = b;
+    for (j /= 2; j > 0; j /= 2) B.node[j] = bracketJoin(B.node[2*j], B.node[2*j+1]);
+}
+
+// leaves lo..hi-1 are read from their slots again, then the nodes above them
+void bracketTreeRefresh(int lo, int hi){
+    if (B.node == NULL || lo >= hi) return;
+    int j;
+    for (j = lo; j < hi; j++) B.node[B.size+j] = bracketSlot(j);
+    lo += B.size;
+    hi += B.size-1;
+    while (lo > 1){
+        lo /= 2;
+        hi /= 2;
+        for (j = lo; j <= hi; j++) B.node[j] = bracketJoin(B.node[2*j], B.node[2*j+1]);
+    }
+}
+
+// first slot at or after from where the running sum, starting at *cur,
+// drops to 0; *cur has the slots before it added. -1 if there is none.
+int bracketFindForward(int node, int nl, int nr, int from, int *cur){
+    if (nr <= from) return -1;
+    if (nl >= from && *cur + B.node[node].minpre > 0){
+        *cur += B.node[node].sum;
+        return -1;
+    }
+    if (nr - nl == 1) return nl;
+    int mid = (nl+nr)/2;
+    int at = bracketFindForward(2*node, nl, mid, from, cur);
+    return at != -1 ? at : bracketFindForward(2*node+1, mid, nr, from, cur);
+}
+
+// last slot before to where *k, going backwards and lowered by every
+// opening bracket, drops to 0. -1 if there is none.
+int bracketFindBackward(int node, int nl, int nr, int to, int *k){
+    if (nl >= to) return -1;
+    if (nr <= to && B.node[node].maxsuf < *k){
+        *k -= B.node[node].sum;
+        return -1;
+    }
+    if (nr - nl == 1) return nl;
+    int mid = (nl+nr)/2;
+    int at = bracketFindBackward(2*node+1, mid, nr, to, k);
+    return at != -1 ? at : bracketFindBackward(2*node, nl, mid, to, k);
+}
+
+/* Row Storage */
+
+// Free slots of E.row are kept together at E.rowgap, so inserting or deleting
+// rows only moves the rows between the gap and the edit, not the whole file
+
+erow *editorRowAt(int at){
+    if (at >= E.rowgap) at += E.rowcap - E.numrows;
+    return &E.row[at];
+}
+
+// inverse of editorRowAt
+int editorRowIndex(erow *row){
+    int at = row - E.row;
+    if (at >= E.rowgap) at -= E.rowcap - E.numrows;
+    return at;
+}
+
+void editorMoveRowGap(int at){
+    int gaplen = E.rowcap - E.numrows;
+    if (at < E.rowgap){
+        memmove(&E.row[at+gaplen], &E.row[at], sizeof(erow)*(E.rowgap-at));
+    } else if (at > E.rowgap){
+        memmove(&E.row[E.rowgap], &E.row[E.rowgap+gaplen], sizeof(erow)*(at-E.rowgap));
+    }
+    int old = E.rowgap;
+    E.rowgap = at;
+    // the slots the rows and the gap moved through
+    if (at != old) bracketTreeRefresh(imin(at, old), imax(at, old) + gaplen);
+}
+
+void editorReserveRows(int n){
+    if (n <= E.rowcap) return;
+    int newcap = imax(n, imax(E.rowcap*2, 64));
+    int tail = E.numrows - E.rowgap;
+    E.row = realloc(E.row, sizeof(erow)*newcap);
+    if (E.row == NULL) die("editorReserveRows: out of memory");
+    // rows after the gap stay at the end of the bigger array
+    memmove(&E.row[newcap-tail], &E.row[E.rowcap-tail], sizeof(erow)*tail);
+    E.rowcap = newcap;
+    if (B.node) bracketTreeBuild();
+}
+
+// grow chars geometrically so typing does not realloc on every keystroke,
+// a row still pointing into the mapped file gets its own copy here. The
+// copy keeps all of the current chars even when the caller is about to
+// shorten the row
+void editorRowReserve(erow *row, int need){
+    need = imax(need, row->size+1);
+    int shared = row->shared && E.save;
+    if (need <= row->cap && !shared) return;
+    int newcap = need <= row->cap ? row->cap : imax(need, imax(row->cap*2, 16));
+    char *chars = arenaAlloc(&E.arena, newcap, &newcap);
+    memcpy(chars, row->chars, row->size);
+    chars[row->size] = '\0';
+    if (shared) editorBury(row->chars, row->cap);
+    else arenaFree(&E.arena, row->chars, row->cap);
+    row->chars = chars;
+    row->shared = 0;
+    row->cap = newcap;
+}
+
+// append the next line of the mapped file as a row that borrows its bytes,
+// render is only built once the row gets drawn, and so are its words
+// unless learn is set
+void editorAppendMappedRow(char *s, size_t len, int learn){
+    editorReserveRows(E.numrows+1);
+    editorMoveRowGap(E.numrows);
+    erow *row = &E.row[E.rowgap++];
+    E.numrows++;
+
+    row->size = len;
+    row->cap = 0;
+    row->chars = s;
+    row->rsize = 0;
+    row->rcap = 0;
+    row->render = NULL;
+    row->stale = 1; // measured once it gets drawn
+    row->shared = 0;
+    row->tabs = NULL;
+    row->ntabs = row->tabcap = 0;
+    row->indexed = 0;
+    row->hl = NULL;
+    row->hlcap = 0;
+    row->hlknown = row->hlready = 0;
+    memset(&row->br, 0, sizeof(row->br));
+    row->words = learn;
+    row->skipped = !learn;
+    editorRowLearnWords(row, 0, row->size);
+    screenMarkRowDirty(E.numrows-1);
+}
+
+// turn lines of the mapped file into rows until there are n rows
+static void editorLoadRows(int n, int learn){
+    if (E.map == NULL) return;
+    while (E.numrows < n && E.mapoff < E.maplen){
+        char *line = &E.map[E.mapoff];
+        size_t linelen, next;
+        if (lineIndexStartOf(E.index, E.mapline+1, &next)){
+            // the indexer already knows where this line ends
+            linelen = next - E.mapoff - 1;
+            E.mapoff = next;
+        } else {
+            char *nl = memchr(line, '\n', E.maplen-E.mapoff);
+            linelen = nl ? (size_t)(nl-line) : E.maplen-E.mapoff;
+            E.mapoff += linelen + (nl != NULL);
+        }
+        E.mapline++;
+        while (linelen > 0 && line[linelen-1] == '\r') linelen--;
+        editorAppendMappedRow(line, linelen, learn);
+    }
+    layoutUpdate();
+}
+
+void editorLoadRowsUntil(int n){
+    editorLoadRows(n, 1);
+}
+
+// rows only loaded to get past them: their words wait until they are drawn
+// and the lexer skips them (see editorLexUntil), so each costs about a memcpy
+void editorSkipRowsUntil(int n){
+    // grown once, not once per doubling, which also rebuilds the bracket tree
+    editorReserveRows(imin(n, editorTotalRows()));
+    editorLoadRows(n, 0);
+}
+
+void editorLoadAllRows(){
+    editorLoadRowsUntil(INT_MAX);
+}
+
+int editorFullyLoaded(){
+    return E.map == NULL || E.mapoff >= E.maplen;
+}
+
+// rows of the buffer, counting lines the viewport has not reached yet
+int editorTotalRows(){
+    if (editorFullyLoaded() || E.index == NULL) return E.numrows;
+    size_t lines = lineIndexLines(E.index);
+    if (lines <= E.mapline) return E.numrows;
+    return E.numrows + (int)(lines - E.mapline);
+}
+
+int editorIndexing(){
+    return E.index && !atomic_load(&E.index->done);
+}
+
+// indexer progress as last drawn => bytes scanned, +1 once done
+static size_t editorIndexState(){
+    return atomic_load(&E.index->scanned) + atomic_load(&E.index->done);
+}
+
+// is there indexer progress the screen has not shown yet
+int editorIndexPending(){
+    return E.index && (!atomic_load(&E.index->done) || E.indexseen != editorIndexState());
+}
+
+// did the indexer publish progress since the last frame
+int editorIndexChanged(){
+    if (E.index == NULL) return 0;
+    size_t state = editorIndexState();
+    if (state == E.indexseen) return 0;
+    E.indexseen = state;
+    return 1;
 }
 
 /* Basic */
 int getRowLength(){
-    erow *row = (E.cy >= E.numrows) ? NULL: &E.row[E.cy];
+    erow *row = (E.cy >= E.numrows) ? NULL: editorRowAt(E.cy);
     int rowlen = row? row->size:0;
     return rowlen;
 }
 
 /* Terminal */
 
+// all output to the terminal goes through here
+void editorWrite(const char *s, int len){
+    if (H.on){
+        H.bytes += len;
+        H.writes++;
+        return;
+    }
+    while (len > 0){
+        ssize_t n = write(STDOUT_FILENO, s, len);
+        if (n == -1){
+            if (errno == EINTR) continue;
+            return;
+        }
+        s += n;
+        len -= n;
+    }
+}
+
 void die(const char *s){
     write(STDOUT_FILENO, "\x1b[2J", 4);
     write(STDOUT_FILENO, "\x1b[H", 3);
@@ -114,6 +1170,7 @@ void die(const char *s){
 
 void disableRawMode(){
     // set back to default
+    editorWrite("\x1b[?2004l", 8); // stop bracketing pastes
     if (tcsetattr(STDERR_FILENO, TCIFLUSH, &E.orig_termios) == -1){
         die("tcsetattr failed while disabling raw mode");
     }
@@ -153,73 +1210,205 @@ void enableRawMode(){
     // VMIN value sets the minimum number of bytes of input needed before read() can return
     raw.c_cc[VMIN] = 0; // set to 0 as that read() returns as soon as there is any input
     // VTIME value sets the maximum amount of time to wait before read() returns.
-    raw.c_cc[VTIME] = CPEDI_READ_WAIT_TIME; // here 500 millisecond;
+    raw.c_cc[VTIME] = 0; // never wait in read(), waiting is done with poll()
 
     // set terminal attributes
     if (tcsetattr(STDERR_FILENO, TCSAFLUSH, &raw) == -1){
         die("tcsetattr failed while enabling raw mode");
     }
+    // bracketed paste => pastes arrive wrapped in <esc>[200~ and <esc>[201~
+    editorWrite("\x1b[?2004h", 8);
     
 }
 
-// wait for one keypress, and return it
-int editorReadKey(){
-    int nread;
-    char c;
-    while((nread = read(STDIN_FILENO, &c, 1)) != 1){
-        if (read(STDIN_FILENO, &c, 1) == -1 && errno != EAGAIN){
-            die("Error while reading from terminal");
-        }
-    }
-
-    if (c == '\x1b'){
-        char seq[3];
-
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
-        // ecs[5~
-        if (seq[0] == '['){
-            if (seq[1] >= '0' && seq[1] <= '9'){
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-                if (seq[2] == '~'){
-                    switch (seq[1])
-                    {   
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
+/* Input Buffer */
 
-                    }
-                }
-            } else {
-                switch (seq[1])
-                {
-                case 'A': return ARROW_UP;
-                case 'B': return ARROW_DOWN;
-                case 'C': return ARROW_RIGHT;
-                case 'D': return ARROW_LEFT;
-                case 'F': return END_KEY;
-                case 'H': return HOME_KEY;
-                }
-            }
-        } else if (seq[0] == 'O'){
-            switch (seq[1])
-            {
-                case 'H': return HOME_KEY;
-                case 'F': return END_KEY;
-            }
-        }
-        return '\x1b';
+// Keys are read in bulk: one read() takes whatever the terminal has, and the
+// bytes are decoded from the buffer. A paste becomes one read instead of one
+// per byte.
+
+// wait up to timeout ms (-1 => forever) for stdin, 1 if there is something to read
+// a wake up from a background thread ends the wait early and sets I.woken
+// a clipboard helper is fed whenever its pipe has room
+// a cut not sent to the system clipboard yet is sent once a wait times out
+int inputWait(int timeout){
+    if (H.on) return H.keylen > 0;
+    struct pollfd pfd[3] = {{STDIN_FILENO, POLLIN, 0}, {I.wake[0], POLLIN, 0}, {clipboardFd(), POLLOUT, 0}};
+    int n = poll(pfd, 3, timeout);
+    if (n == -1 && errno != EINTR) die("poll failed while waiting for input");
+    // no key for a whole wait => a run of cuts is over
+    if (n == 0 && timeout != 0) clipboardFlush();
+    if (clipboardBusy()) clipboardService();
+    if (n > 0 && (pfd[1].revents & POLLIN)){
+        char drain[64];
+        while (read(I.wake[0], drain, sizeof(drain)) > 0);
+        I.woken = 1;
     }
+    return n > 0 && (pfd[0].revents & POLLIN);
+}
 
-    return c;
+// called from background threads when they have something to show
+void editorWake(){
+    char c = 1;
+    if (write(I.wake[1], &c, 1) == -1){
+        // pipe is full, a wake up is already pending
+    }
 }
 
-int getCursorPosition(int *rows, int *cols){
-    char buf[32];
+// read everything available after waiting up to timeout ms, 1 if bytes came in
+int inputFill(int timeout){
+    if (I.pos > 0){
+        memmove(I.buf, &I.buf[I.pos], I.len-I.pos);
+        I.len -= I.pos;
+        I.pos = 0;
+    }
+    if (I.len == (int)sizeof(I.buf)) return 1;
+    if (!inputWait(timeout)) return 0;
+    int n;
+    if (H.on){
+        size_t room = sizeof(I.buf)-I.len;
+        n = H.keylen < room ? H.keylen : room;
+        memcpy(&I.buf[I.len], H.keys, n);
+        H.keys += n;
+        H.keylen -= n;
+    } else {
+        n = read(STDIN_FILENO, &I.buf[I.len], sizeof(I.buf)-I.len);
+    }
+    if (n == -1 && errno != EAGAIN && errno != EINTR){
+        die("Error while reading from terminal");
+    }
+    if (n <= 0) return 0;
+    I.len += n;
+    return 1;
+}
+
+// keys ready to be processed without blocking
+int editorInputPending(){
+    return I.pos < I.len || inputWait(0);
+}
+
+// decode the key at the start of s, returns bytes used or 0 if the
+// sequence is cut short and more bytes are needed
+int inputDecode(const unsigned char *s, int n, int *key){
+    if (s[0] != '\x1b'){
+        *key = s[0];
+        return 1;
+    }
+    if (n < 2) return 0;
+    if (s[1] == '['){
+        // <esc>[ params final => params are digits and ';', final is a letter or '~'
+        int i = 2, param = 0;
+        while (i < n && s[i] >= 0x20 && s[i] <= 0x3f){
+            if (isdigit(s[i])) param = param*10 + (s[i]-'0');
+            i++;
+        }
+        if (i == n) return n > 32 ? n : 0; // give up on runaway sequences
+        *key = NO_KEY; // unknown sequences are swallowed
+        if (s[i] == '~'){
+            switch (param)
+            {
+                case 200: *key = PASTE_BEGIN; break;
+                case 1: *key = HOME_KEY; break;
+                case 3: *key = DEL_KEY; break;
+                case 4: *key = END_KEY; break;
+                case 5: *key = PAGE_UP; break;
+                case 6: *key = PAGE_DOWN; break;
+                case 7: *key = HOME_KEY; break;
+                case 8: *key = END_KEY; break;
+            }
+        } else {
+            switch (s[i])
+            {
+                case 'A': *key = ARROW_UP; break;
+                case 'B': *key = ARROW_DOWN; break;
+                case 'C': *key = ARROW_RIGHT; break;
+                case 'D': *key = ARROW_LEFT; break;
+                case 'F': *key = END_KEY; break;
+                case 'H': *key = HOME_KEY; break;
+            }
+        }
+        return i+1;
+    }
+    if (s[1] == 'O'){
+        if (n < 3) return 0;
+        *key = NO_KEY;
+        if (s[2] == 'H') *key = HOME_KEY;
+        if (s[2] == 'F') *key = END_KEY;
+        return 3;
+    }
+    *key = '\x1b';
+    return 1;
+}
+
+static void inputAppendPaste(const unsigned char *s, size_t len){
+    if (I.pastelen + len > I.pastecap){
+        size_t need = I.pastelen + len;
+        I.pastecap = need > I.pastecap*2 ? need : I.pastecap*2;
+        I.paste = realloc(I.paste, I.pastecap);
+        if (I.paste == NULL) die("inputAppendPaste: out of memory");
+    }
+    memcpy(&I.paste[I.pastelen], s, len);
+    I.pastelen += len;
+}
+
+// collect everything up to <esc>[201~ as the text of a paste
+int inputReadPaste(){
+    static const char endmark[] = "\x1b[201~";
+    const int marklen = sizeof(endmark)-1;
+    I.pastelen = 0;
+    while (1){
+        unsigned char *p = &I.buf[I.pos];
+        int n = I.len - I.pos;
+        unsigned char *end = memmem(p, n, endmark, marklen);
+        if (end){
+            inputAppendPaste(p, end-p);
+            I.pos += end-p + marklen;
+            return PASTE_KEY;
+        }
+        // the last bytes could be the start of the end mark
+        int take = imax(0, n - (marklen-1));
+        inputAppendPaste(p, take);
+        I.pos += take;
+        if (!inputFill(CPEDI_PASTE_WAIT_TIME)){
+            // the end mark never came, take what is there
+            inputAppendPaste(&I.buf[I.pos], I.len-I.pos);
+            I.pos = I.len;
+            return PASTE_KEY;
+        }
+    }
+}
+
+// wait for one keypress, and return it
+int editorReadKey(){
+    while (1){
+        int key;
+        int used = I.pos < I.len ? inputDecode(&I.buf[I.pos], I.len-I.pos, &key) : 0;
+        if (used){
+            I.pos += used;
+            if (key == PASTE_BEGIN) return inputReadPaste();
+            return key;
+        }
+        if (I.pos < I.len){
+            // rest of an escape sequence arrives right behind it, if nothing
+            // comes it was the escape key on its own
+            if (!inputFill(CPEDI_ESC_WAIT_TIME)){
+                I.pos++;
+                return '\x1b';
+            }
+            continue;
+        }
+        // background work wants the screen redrawn now and then
+        int timeout = editorIndexPending() || clipboardBusy() ? CPEDI_READ_WAIT_TIME : -1;
+        // without a terminal there is nothing to wait for
+        if (!inputFill(timeout) && (I.woken || editorIndexChanged() || H.on)){
+            I.woken = 0;
+            return NO_KEY;
+        }
+    }
+}
+
+int getCursorPosition(int *rows, int *cols){
+    char buf[32];
     unsigned int i = 0;
 
     if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
@@ -227,7 +1416,7 @@ int getCursorPosition(int *rows, int *cols){
 
     while (i < sizeof(buf) - 1)
     {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
+        if (!inputWait(CPEDI_READ_WAIT_TIME) || read(STDIN_FILENO, &buf[i], 1) != 1) break;
         if (buf[i] == 'R') break;
         i++;
     }
@@ -242,6 +1431,11 @@ int getCursorPosition(int *rows, int *cols){
 
 int getWindowSize(int *rows, int *cols){
     struct winsize ws;
+    if (H.on){
+        *rows = H.rows;
+        *cols = H.cols;
+        return 0;
+    }
 
     // TIOCGWINSZ => Terminal Input/Output Control Get WINdow SiZe.
     if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws)==-1 || ws.ws_col == 0){
@@ -258,95 +1452,859 @@ int getWindowSize(int *rows, int *cols){
 
 /* row operations */
 
+/* Tab Index */
+
+// Every row keeps the positions of its tabs and the render column each tab
+// ends on, so mapping between chars and render is a binary search instead of
+// a walk over the row. Edits shift the stops behind them and recompute their
+// columns until one comes out the same as before.
+
+// room for n stops, grown geometrically like chars
+void editorRowReserveTabs(erow *row, int n){
+    int need = n*sizeof(struct tabStop);
+    if (need <= row->tabcap) return;
+    char *tabs = arenaAlloc(&E.arena, imax(need, row->tabcap*2), &need);
+    if (row->ntabs) memcpy(tabs, row->tabs, row->ntabs*sizeof(struct tabStop));
+    arenaFree(&E.arena, (char *)row->tabs, row->tabcap);
+    row->tabs = (struct tabStop *)tabs;
+    row->tabcap = need;
+}
+
+void editorRowIndexTabs(erow *row){
+    if (row->indexed) return;
+    row->ntabs = 0;
+    row->indexed = 1;
+    const char *p = row->chars, *end = row->chars + row->size;
+    int rx = 0, last = -1;
+    while ((p = memchr(p, '\t', end-p)) != NULL){
+        int cx = p - row->chars;
+        editorRowReserveTabs(row, row->ntabs+1);
+        rx += cx - last - 1;
+        rx += CPEDI_TAB_STOP - rx%CPEDI_TAB_STOP;
+        row->tabs[row->ntabs].cx = cx;
+        row->tabs[row->ntabs].rx = rx;
+        row->ntabs++;
+        last = cx;
+        p++;
+    }
+}
+
+// number of tabs before chars[cx]
+int editorRowTabsBefore(erow *row, int cx){
+    int lo = 0, hi = row->ntabs;
+    while (lo < hi){
+        int mid = (lo+hi)/2;
+        if (row->tabs[mid].cx < cx) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// recompute the columns from stop k on, stops after one that did not move keep theirs
+void editorRowFixTabs(erow *row, int k){
+    for (; k < row->ntabs; k++){
+        int rx = k ? row->tabs[k-1].rx : 0;
+        int last = k ? row->tabs[k-1].cx : -1;
+        rx += row->tabs[k].cx - last - 1;
+        rx += CPEDI_TAB_STOP - rx%CPEDI_TAB_STOP;
+        if (rx == row->tabs[k].rx) return;
+        row->tabs[k].rx = rx;
+    }
+}
+
+// len bytes were inserted at chars[at]
+void editorRowTabsInserted(erow *row, int at, int len){
+    if (!row->indexed) return;
+    int k = editorRowTabsBefore(row, at);
+    int j, added = 0;
+    for (j = at; j < at+len; j++){
+        if (row->chars[j] == '\t') added++;
+    }
+    if (row->ntabs + added == 0) return;
+    editorRowReserveTabs(row, row->ntabs+added);
+    memmove(&row->tabs[k+added], &row->tabs[k], (row->ntabs-k)*sizeof(struct tabStop));
+    for (j = k+added; j < row->ntabs+added; j++) row->tabs[j].cx += len;
+    row->ntabs += added;
+    int t = k;
+    for (j = at; j < at+len; j++){
+        if (row->chars[j] != '\t') continue;
+        row->tabs[t].cx = j;
+        row->tabs[t++].rx = -1; // computed by the fix below
+    }
+    editorRowFixTabs(row, k);
+}
+
+// len bytes were deleted from chars[at]
+void editorRowTabsDeleted(erow *row, int at, int len){
+    if (!row->indexed || row->ntabs == 0) return;
+    int k = editorRowTabsBefore(row, at);
+    int end = editorRowTabsBefore(row, at+len);
+    memmove(&row->tabs[k], &row->tabs[end], (row->ntabs-end)*sizeof(struct tabStop));
+    row->ntabs -= end-k;
+    int j;
+    for (j = k; j < row->ntabs; j++) row->tabs[j].cx -= len;
+    editorRowFixTabs(row, k);
+}
+
 int editorRowCxtoRx(erow *row, int cx){
-    int rx = 0;
+    editorRowIndexTabs(row);
+    int k = editorRowTabsBefore(row, cx);
+    if (k == 0) return cx;
+    return row->tabs[k-1].rx + cx - row->tabs[k-1].cx - 1;
+}
+
+// a column inside a tab maps to the tab
+int editorRowRxtoCx(erow *row, int rx){
+    editorRowIndexTabs(row);
+    int lo = 0, hi = row->ntabs;
+    while (lo < hi){
+        int mid = (lo+hi)/2;
+        if (row->tabs[mid].rx <= rx) lo = mid+1;
+        else hi = mid;
+    }
+    int cx = lo ? row->tabs[lo-1].cx + 1 + rx - row->tabs[lo-1].rx : rx;
+    if (lo < row->ntabs) cx = imin(cx, row->tabs[lo].cx);
+    return imin(cx, row->size);
+}
+
+/* Word Index */
+
+// Every identifier of a C/C++ buffer is counted in a trie. The row
+// operations forget the identifiers touching the bytes they are about to
+// change and learn the ones touching the bytes they changed, so the trie
+// follows the buffer without being rebuilt.
+
+static int isIdent(int c){
+    return isalnum(c) || c == '_';
+}
+
+static int trieChild(int parent, char c, int create){
     int j;
-    for (j = 0; j < cx; j++){
-        if (row->chars[j] == '\t'){
-            rx += (CPEDI_TAB_STOP - 1) - (rx%CPEDI_TAB_STOP);
+    for (j = T.node[parent].child; j; j = T.node[j].next){
+        if (T.node[j].c == c) return j;
+    }
+    if (!create) return 0;
+    if (T.n == T.cap){
+        T.cap = imax(1024, T.cap*2);
+        T.node = realloc(T.node, sizeof(struct trieNode)*T.cap);
+        if (T.node == NULL) die("trieChild: out of memory");
+    }
+    j = T.n++;
+    T.node[j] = (struct trieNode){0, T.node[parent].child, 0, 0, c};
+    T.node[parent].child = j;
+    return j;
+}
+
+// count the identifier d more (or fewer) times
+void trieAdd(const char *s, int len, int d){
+    if (T.node == NULL){
+        if (d < 0) return;
+        T.cap = 1024;
+        T.node = calloc(T.cap, sizeof(struct trieNode));
+        if (T.node == NULL) die("trieAdd: out of memory");
+        T.n = 1;
+    }
+    int j, at = 0;
+    T.node[0].below += d;
+    for (j = 0; j < len; j++){
+        at = trieChild(at, s[j], d > 0);
+        if (at == 0) return;
+        T.node[at].below += d;
+    }
+    T.node[at].count += d;
+}
+
+void trieFree(){
+    free(T.node);
+    memset(&T, 0, sizeof(T));
+}
+
+// count the identifiers that lie in chars[lo..hi) or run into it, d is 1 or -1
+static void editorRowWords(erow *row, int lo, int hi, int d){
+    if (!E.syntax || !row->words) return;
+    while (lo > 0 && isIdent((unsigned char)row->chars[lo-1])) lo--;
+    while (hi < row->size && isIdent((unsigned char)row->chars[hi])) hi++;
+    int j = lo;
+    while (j < hi){
+        if (!isIdent((unsigned char)row->chars[j])){
+            j++;
+            continue;
+        }
+        int start = j;
+        while (j < hi && isIdent((unsigned char)row->chars[j])) j++;
+        // numbers are not identifiers, single letters are not worth it
+        if (!isdigit((unsigned char)row->chars[start]) && j - start >= 2 && j - start <= CPEDI_IDENT_MAX){
+            trieAdd(&row->chars[start], j - start, d);
         }
-        rx++;
     }
-    return rx;
 }
 
-void editorUpdateRow(erow *row){
-    int tabs = 0;
+// chars[at..at+len) is about to change
+void editorRowForgetWords(erow *row, int at, int len){
+    editorRowWords(row, at, at+len, -1);
+}
+
+// chars[at..at+len) changed
+void editorRowLearnWords(erow *row, int at, int len){
+    editorRowWords(row, at, at+len, 1);
+}
+
+// the trie for the rows that are loaded and learned, or nothing without syntax
+void editorIndexWords(){
+    trieFree();
     int j;
-    for (j = 0; j < row->size; j++){
-        if (row->chars[j] == '\t') tabs++;
+    for (j = 0; j < E.numrows; j++){
+        erow *row = editorRowAt(j);
+        editorRowLearnWords(row, 0, row->size);
     }
+}
 
-    free(row->render);
-    row->render = malloc(row->size + tabs*(CPEDI_TAB_STOP-1) +1);
+/* Rendering */
 
-    int idx = 0;
-    for (j = 0; j < row->size; j++){
-        if (row->chars[j] == '\t'){
-            row->render[idx++] = ' ';
-            while(idx%CPEDI_TAB_STOP != 0) row->render[idx++] = ' ';
-        } else {
-            row->render[idx++] = row->chars[j];
-        }
+// Most lines have no tabs, they are drawn straight from chars. Only a line
+// with tabs gets a render buffer with them expanded.
+void editorRenderRow(erow *row){
+    if (!row->words){
+        row->words = 1;
+        editorRowLearnWords(row, 0, row->size);
+    }
+    editorRowIndexTabs(row);
+    row->stale = 0;
+    screenMarkRowDirty(editorRowIndex(row));
+    if (row->ntabs == 0){
+        arenaFree(&E.arena, row->render, row->rcap);
+        row->render = NULL;
+        row->rcap = 0;
+        row->rsize = row->size;
+        return;
+    }
+
+    struct tabStop *last = &row->tabs[row->ntabs-1];
+    int need = last->rx + row->size - last->cx - 1 + 1;
+    if (need > row->rcap){
+        arenaFree(&E.arena, row->render, row->rcap);
+        row->render = arenaAlloc(&E.arena, need, &row->rcap);
+    }
+
+    // copy the runs between tabs, each tab becomes spaces up to its column
+    int idx = 0, from = 0, k;
+    for (k = 0; k < row->ntabs; k++){
+        int run = row->tabs[k].cx - from;
+        memcpy(&row->render[idx], &row->chars[from], run);
+        idx += run;
+        memset(&row->render[idx], ' ', row->tabs[k].rx - idx);
+        idx = row->tabs[k].rx;
+        from = row->tabs[k].cx + 1;
     }
+    memcpy(&row->render[idx], &row->chars[from], row->size - from);
+    idx += row->size - from;
     row->render[idx] = '\0';
     row->rsize = idx;
 }
 
-void editorInsertRow(int at, char *s, size_t len){
-    if (at < 0 || at > E.numrows) return;
+// the row as it is drawn, rsize bytes long
+const char *editorRowRender(erow *row){
+    return row->render ? row->render : row->chars;
+}
+
+/* Syntax Highlighting */
 
-    E.row = realloc(E.row, sizeof(erow)*(E.numrows+1));
-    memmove(&E.row[at+1], &E.row[at], sizeof(erow)*(E.numrows-at));
+// Rows are lexed as C++ on the way to the screen. Every row remembers the
+// state the lexer was in at its start and its end, so after an edit only the
+// changed row is lexed again, and the rows after it only as long as the
+// state they start in comes out different. Rows that are not drawn only get
+// their end state, their highlight array is filled in when they are drawn.
 
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len+1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+char *CPEDI_KEYWORDS[] = {
+    "if", "else", "for", "while", "do", "switch", "case", "default", "break",
+    "continue", "return", "goto", "using", "namespace", "template", "typename",
+    "class", "struct", "union", "enum", "public", "private", "protected",
+    "virtual", "override", "const", "constexpr", "static", "inline", "extern",
+    "new", "delete", "operator", "this", "sizeof", "true", "false", "nullptr",
+    "try", "catch", "throw", "typedef", "friend", "explicit", "mutable",
+    "volatile", "noexcept", "decltype", "static_cast", "const_cast",
+    "dynamic_cast", "reinterpret_cast", "and", "or", "not", NULL
+};
 
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    editorUpdateRow(&E.row[at]);
+char *CPEDI_TYPES[] = {
+    "int", "long", "short", "char", "bool", "float", "double", "void", "auto",
+    "unsigned", "signed", "size_t", "ll", "ull", "ld", "int64_t", "uint64_t",
+    "int32_t", "uint32_t", "string", "vector", "map", "set", "multiset",
+    "multimap", "unordered_map", "unordered_set", "pair", "tuple", "queue",
+    "deque", "stack", "priority_queue", "array", "bitset", NULL
+};
 
-    E.numrows++;
-    E.dirty++;
+static int isSeparator(int c){
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[]{};:!?&|^\"'", c) != NULL;
+}
+
+static int wordIn(char **words, const char *s, int len){
+    int j;
+    for (j = 0; words[j]; j++){
+        if ((int)strlen(words[j]) == len && memcmp(words[j], s, len) == 0) return 1;
+    }
+    return 0;
+}
+
+static void bracketAdd(struct bracketSum *b, int v){
+    b->sum += v;
+    b->minpre = imin(b->minpre, b->sum);
+    b->maxsuf = imax(b->maxsuf + v, 0);
+}
+
+// +1 for an opening bracket, -1 for a closing one, 0 for anything else
+static int bracketValue(char c){
+    if (c == '(' || c == '[' || c == '{') return 1;
+    if (c == ')' || c == ']' || c == '}') return -1;
+    return 0;
+}
+
+// lex the row starting in state, returns the state at its end. hl gets the
+// cellAttr of every byte, br the sums of the brackets in code and list their
+// columns, any of them can be NULL.
+int editorLexRow(const char *s, int len, int state, unsigned char *hl,
+                 struct bracketSum *br, struct bracketList *list){
+    int i = 0;
+#define MARK(from, n, attr) do { if (hl && (n) > 0) memset(&hl[from], (attr), (n)); } while (0)
+    MARK(0, len, ATTR_NORMAL);
+    while (i < len && (s[i] == ' ' || s[i] == '\t')) i++;
+    if (state == LEX_NORMAL && i < len && s[i] == '#') state = LEX_PREPROC;
+    int preproc = state == LEX_PREPROC;
+    if (preproc) MARK(0, len, ATTR_PREPROC);
+    if (state == LEX_PREPROC) state = LEX_NORMAL;
+
+    int prevsep = 1;
+    i = 0;
+    while (i < len){
+        char c = s[i];
+        if (state == LEX_COMMENT){
+            const char *end = i+1 < len ? memmem(&s[i], len-i, "*/", 2) : NULL;
+            int stop = end ? (int)(end - s) + 2 : len;
+            MARK(i, stop-i, ATTR_COMMENT);
+            if (end) state = LEX_NORMAL;
+            i = stop;
+            prevsep = 1;
+            continue;
+        }
+        if (c == '/' && i+1 < len && s[i+1] == '/'){
+            MARK(i, len-i, ATTR_COMMENT);
+            return LEX_NORMAL;
+        }
+        if (c == '/' && i+1 < len && s[i+1] == '*'){
+            MARK(i, 2, ATTR_COMMENT);
+            state = LEX_COMMENT;
+            i += 2;
+            continue;
+        }
+        if (c == '"' || c == '\''){
+            int j = i+1;
+            while (j < len && s[j] != c){
+                if (s[j] == '\\' && j+1 < len) j++;
+                j++;
+            }
+            j = imin(j+1, len);
+            MARK(i, j-i, ATTR_STRING);
+            i = j;
+            prevsep = 1;
+            continue;
+        }
+        if (preproc){
+            i++;
+            continue;
+        }
+        if (prevsep && isdigit((unsigned char)c)){
+            int j = i;
+            while (j < len && (isalnum((unsigned char)s[j]) || s[j] == '.' || s[j] == '\'')) j++;
+            MARK(i, j-i, ATTR_NUMBER);
+            i = j;
+            prevsep = 0;
+            continue;
+        }
+        if (prevsep && (isalpha((unsigned char)c) || c == '_')){
+            int j = i;
+            while (j < len && (isalnum((unsigned char)s[j]) || s[j] == '_')) j++;
+            if (hl){
+                if (wordIn(CPEDI_KEYWORDS, &s[i], j-i)) MARK(i, j-i, ATTR_KEYWORD);
+                else if (wordIn(CPEDI_TYPES, &s[i], j-i)) MARK(i, j-i, ATTR_TYPE);
+            }
+            i = j;
+            prevsep = 0;
+            continue;
+        }
+        int v = bracketValue(c);
+        if (v && br) bracketAdd(br, v);
+        if (v && list){
+            if (list->n == list->cap){
+                list->cap = imax(16, list->cap*2);
+                list->cols = realloc(list->cols, sizeof(int)*list->cap);
+                if (list->cols == NULL) die("editorLexRow: out of memory");
+            }
+            list->cols[list->n++] = i;
+        }
+        prevsep = isSeparator((unsigned char)c);
+        i++;
+    }
+#undef MARK
+    // a directive goes on past a trailing backslash
+    if (preproc && state == LEX_NORMAL && len > 0 && s[len-1] == '\\') return LEX_PREPROC;
+    return state;
+}
+
+// state the lexer is in at the start of row at
+int editorRowLexIn(int at){
+    return at > 0 ? editorRowAt(at-1)->hlout : LEX_NORMAL;
+}
+
+// lex row j if the state it starts in is not the one it was lexed from. A
+// row that is lexed again looks different, so it is redrawn if it is on
+// screen, and its brackets go into the tree. 1 if it was lexed
+static int editorLexRowAt(int j, int in){
+    erow *row = editorRowAt(j);
+    if (row->hlknown && row->hlin == in) return 0;
+    // tabs do not change the state, chars does as well as render
+    struct bracketSum br = {0, 0, 0};
+    row->hlout = editorLexRow(row->chars, row->size, in, NULL, &br, NULL);
+    row->hlin = in;
+    row->hlknown = 1;
+    row->hlready = 0;
+    if (memcmp(&br, &row->br, sizeof(br)) != 0){
+        row->br = br;
+        bracketTreeSet(row - E.row, br);
+    }
+    screenMarkRowDirty(j);
+    return 1;
+}
+
+// rows before at get known end states, rows that already start in the state
+// they were lexed from are not lexed again. Once past the last edited row
+// that holds for every row up to E.hltop, so they are skipped in one step.
+// A row a jump went far past the lexed ones for is not worth lexing every
+// row on the way for: the lexer starts CPEDI_LEX_BACK rows above it as if
+// nothing was open there. Lexing from the top fixes what that got wrong
+// once it gets there, it lexes again every row that starts in another
+// state than it was lexed from.
+void editorLexUntil(int at){
+    int j;
+    if (at - E.hlvalid > CPEDI_LEX_GAP && editorRowAt(at - CPEDI_LEX_BACK)->skipped &&
+        (E.hlguess == -1 || at <= E.hlguess || at - E.hlfar > CPEDI_LEX_GAP)){
+        E.hlguess = E.hlfar = at - CPEDI_LEX_BACK;
+        // E.hltop may not skip over rows lexed from a guess
+        E.hltop = imin(E.hltop, E.hlguess);
+    }
+    if (E.hlguess != -1 && E.hlvalid < E.hlguess && at > E.hlguess){
+        for (j = E.hlfar; j < at; j++) editorLexRowAt(j, j == E.hlguess ? LEX_NORMAL : editorRowLexIn(j));
+        E.hlfar = imax(E.hlfar, at);
+        return;
+    }
+    for (j = E.hlvalid; j < at; j++){
+        erow *row = editorRowAt(j);
+        int in = editorRowLexIn(j);
+        if (row->hlknown && row->hlin == in){
+            if (j > E.hldirty && j < E.hltop){
+                E.hldirty = -1;
+                j = E.hltop-1;
+            }
+            continue;
+        }
+        editorLexRowAt(j, in);
+    }
+    E.hlvalid = imax(E.hlvalid, at);
+    E.hltop = imax(E.hltop, E.hlvalid);
+    if (E.hlvalid >= E.hlguess) E.hlguess = -1;
+}
+
+// the highlight array of a row that is about to be drawn, NULL without syntax
+unsigned char *editorRowHighlight(int at){
+    if (!E.syntax) return NULL;
+    editorLexUntil(at+1);
+    erow *row = editorRowAt(at);
+    if (row->hlready) return row->hl;
+    if (row->rsize > row->hlcap){
+        arenaFree(&E.arena, (char *)row->hl, row->hlcap);
+        row->hl = (unsigned char *)arenaAlloc(&E.arena, row->rsize, &row->hlcap);
+    }
+    editorLexRow(editorRowRender(row), row->rsize, row->hlin, row->hl, NULL, NULL);
+    row->hlready = 1;
+    return row->hl;
+}
+
+// the text of the row changed, it is lexed again when needed
+void editorRowHighlightStale(erow *row, int at){
+    row->hlknown = row->hlready = 0;
+    if (E.hlguess != -1 && at >= E.hlguess) E.hlfar = imin(E.hlfar, at);
+    E.hltop = imax(E.hltop, E.hlvalid);
+    E.hlvalid = imin(E.hlvalid, at);
+    E.hldirty = imax(E.hldirty, at);
+}
+
+// rows from at on moved by count, inserted rows are not lexed yet
+void editorHighlightRowsMoved(int at, int count){
+    E.hltop = imax(E.hltop, E.hlvalid);
+    E.hlvalid = imin(E.hlvalid, at);
+    if (E.hltop > at) E.hltop = imax(at, E.hltop + count);
+    if (E.hldirty >= at) E.hldirty = imax(at, E.hldirty + count);
+    if (count > 0) E.hldirty = imax(E.hldirty, at + count-1);
+    if (E.hlguess == -1) return;
+    if (at > E.hlguess){
+        E.hlfar = imin(E.hlfar, at);
+    } else if (count > 0 || at - count <= E.hlguess){
+        E.hlguess += count;
+        E.hlfar += count;
+    } else {
+        // the row the guess started at was deleted
+        E.hlguess = E.hlfar = at;
+    }
+    if (E.hlvalid >= E.hlguess) E.hlguess = -1;
+}
+
+/* Brackets */
+
+// Brackets in code are summed per row by the lexer and the sums go into the
+// bracket tree, so finding the partner of a bracket is a walk over at most
+// two rows plus a descent of the tree. Only rows that were loaded count.
+
+static struct bracketList BL;
+
+// columns of the brackets of a row that is lexed
+static void editorRowBrackets(int at){
+    erow *row = editorRowAt(at);
+    BL.n = 0;
+    editorLexRow(row->chars, row->size, row->hlin, NULL, NULL, &BL);
+}
+
+// closing bracket for depth cur from column col of row at on, 1 if found
+int editorBracketForward(int at, int col, int cur, int *mrow, int *mcol){
+    int j;
+    editorRowBrackets(at);
+    for (j = 0; j < BL.n; j++){
+        if (BL.cols[j] < col) continue;
+        cur += bracketValue(editorRowAt(at)->chars[BL.cols[j]]);
+        if (cur == 0) goto found;
+    }
+    int slot = bracketFindForward(1, 0, B.size, editorRowAt(at) - E.row + 1, &cur);
+    if (slot == -1) return 0;
+    at = editorRowIndex(&E.row[slot]);
+    editorRowBrackets(at);
+    for (j = 0; j < BL.n; j++){
+        cur += bracketValue(editorRowAt(at)->chars[BL.cols[j]]);
+        if (cur == 0) goto found;
+    }
+    return 0;
+found:
+    *mrow = at;
+    *mcol = BL.cols[j];
+    return 1;
+}
+
+// opening bracket for depth k before column col of row at, 1 if found
+int editorBracketBackward(int at, int col, int k, int *mrow, int *mcol){
+    int j;
+    editorRowBrackets(at);
+    for (j = BL.n-1; j >= 0; j--){
+        if (BL.cols[j] >= col) continue;
+        k -= bracketValue(editorRowAt(at)->chars[BL.cols[j]]);
+        if (k == 0) goto found;
+    }
+    int slot = bracketFindBackward(1, 0, B.size, editorRowAt(at) - E.row, &k);
+    if (slot == -1) return 0;
+    at = editorRowIndex(&E.row[slot]);
+    editorRowBrackets(at);
+    for (j = BL.n-1; j >= 0; j--){
+        k -= bracketValue(editorRowAt(at)->chars[BL.cols[j]]);
+        if (k == 0) goto found;
+    }
+    return 0;
+found:
+    *mrow = at;
+    *mcol = BL.cols[j];
+    return 1;
+}
+
+// lex every loaded row, the tree is built on first use
+static int editorBracketsReady(){
+    if (!E.syntax || E.numrows == 0) return 0;
+    if (B.node == NULL) bracketTreeBuild();
+    editorLexUntil(E.numrows);
+    return 1;
+}
+
+// bracket in code under the cursor, 0 if there is none
+static int editorBracketAtCursor(){
+    erow *row = editorRowAt(E.cy);
+    int v = E.cx < row->size ? bracketValue(row->chars[E.cx]) : 0;
+    if (v == 0) return 0;
+    int j;
+    editorRowBrackets(E.cy);
+    for (j = 0; j < BL.n; j++){
+        if (BL.cols[j] == E.cx) return v;
+    }
+    return 0;
+}
+
+// find the bracket under the cursor and its partner, or else the brackets
+// around the cursor. The rows they are on are redrawn when they change.
+void editorFindBlock(){
+    struct bracketPair old = BP;
+    BP.orow = BP.crow = -1;
+    if (editorBracketsReady() && E.cy < E.numrows){
+        int v = editorBracketAtCursor();
+        if (v < 0){
+            BP.crow = E.cy;
+            BP.ccol = E.cx;
+            if (!editorBracketBackward(E.cy, E.cx, 1, &BP.orow, &BP.ocol)) BP.orow = -1;
+        } else if (v > 0 || editorBracketBackward(E.cy, E.cx, 1, &BP.orow, &BP.ocol)){
+            if (v > 0){
+                BP.orow = E.cy;
+                BP.ocol = E.cx;
+            }
+            if (!editorBracketForward(BP.orow, BP.ocol+1, 1, &BP.crow, &BP.ccol)) BP.crow = -1;
+        }
+    }
+    if (memcmp(&old, &BP, sizeof(BP)) != 0){
+        screenMarkRowDirty(old.orow);
+        screenMarkRowDirty(old.crow);
+        screenMarkRowDirty(BP.orow);
+        screenMarkRowDirty(BP.crow);
+    }
+}
+
+static int bracketsPair(char open, char close){
+    return (open == '(' && close == ')') || (open == '[' && close == ']') || (open == '{' && close == '}');
+}
+
+// jump to the partner of the bracket under the cursor, or to the start of
+// the block around it. A closing bracket past the loaded rows is looked for
+// by loading the mapped file a piece at a time, a key stops that.
+void editorJumpBracket(){
+    if (!editorBracketsReady()){
+        editorSetStatusMessage("Brackets are only tracked in C/C++ files");
+        return;
+    }
+    if (E.cy >= E.numrows) return;
+    int v = editorBracketAtCursor();
+    int mrow, mcol, found;
+    if (v > 0){
+        while (!(found = editorBracketForward(E.cy, E.cx+1, 1, &mrow, &mcol)) && !editorFullyLoaded()){
+            editorLoadRowsUntil(E.numrows + CPEDI_SEARCH_LOAD);
+            editorBracketsReady();
+            if (editorInputPending()){
+                editorSetStatusMessage("Stopped looking for the bracket at line %d", E.numrows);
+                return;
+            }
+        }
+    } else {
+        found = editorBracketBackward(E.cy, E.cx, 1, &mrow, &mcol);
+    }
+    if (!found){
+        editorSetStatusMessage(v > 0 ? "Bracket is never closed" : "No matching bracket");
+        return;
+    }
+    if (v){
+        char a = editorRowAt(E.cy)->chars[E.cx], b = editorRowAt(mrow)->chars[mcol];
+        if (!(v > 0 ? bracketsPair(a, b) : bracketsPair(b, a))){
+            editorSetStatusMessage("Mismatched %c and %c", v > 0 ? a : b, v > 0 ? b : a);
+        }
+    }
+    E.cy = mrow;
+    E.cx = mcol;
+}
+
+// a bracket with no partner in the whole file for the status bar, 0 if balanced
+int editorUnbalanced(int *row, char *c){
+    // rows a jump went past have no brackets in the tree yet
+    if (!editorFullyLoaded() || !editorBracketsReady() || E.hlguess != -1) return 0;
+    struct bracketSum all = B.node[1];
+    int col;
+    if (all.minpre < 0){
+        // the first closing bracket the running sum goes below zero on
+        int cur = 1, slot = bracketFindForward(1, 0, B.size, 0, &cur);
+        if (slot == -1) return 0;
+        *row = editorRowIndex(&E.row[slot]);
+        if (!editorBracketForward(*row, 0, cur, row, &col)) return 0;
+    } else if (all.sum > 0){
+        // the last opening bracket with no closing one after it
+        int k = 1, slot = bracketFindBackward(1, 0, B.size, B.size, &k);
+        if (slot == -1) return 0;
+        *row = editorRowIndex(&E.row[slot]);
+        if (!editorBracketBackward(*row, INT_MAX, k, row, &col)) return 0;
+    } else {
+        return 0;
+    }
+    *c = editorRowAt(*row)->chars[col];
+    return 1;
+}
+
+// C and C++ files are highlighted, so is a buffer without a name
+void editorSelectSyntax(){
+    E.syntax = 1;
+    E.hlvalid = E.hltop = 0;
+    E.hlguess = -1;
+    E.hldirty = -1;
+    BP.orow = BP.crow = -1;
+    if (E.filename == NULL){
+        editorIndexWords();
+        return;
+    }
+    char *ext = strrchr(E.filename, '.');
+    char *exts[] = {".cpp", ".cc", ".cxx", ".c", ".hpp", ".hh", ".h", NULL};
+    E.syntax = ext != NULL && wordIn(exts, ext, strlen(ext));
+    editorIndexWords();
+}
+
+// chars of the row changed, inside a transaction it is rendered at commit
+void editorUpdateRow(erow *row){
+    editorRowHighlightStale(row, editorRowIndex(row));
+    if (E.txdepth == 0){
+        editorRenderRow(row);
+        return;
+    }
+    int at = editorRowIndex(row);
+    row->stale = 1;
+    E.txlo = imin(E.txlo, at);
+    E.txhi = imax(E.txhi, at);
+}
+
+// the buffer was modified, counted once per transaction
+void editorMarkModified(){
+    if (E.txdepth) E.txdirty = 1;
+    else E.dirty++;
+}
+
+// rows from at on moved by count (negative for deletes)
+void editorRowsMoved(int at, int count){
+    editorHighlightRowsMoved(at, count);
+    if (E.txdepth == 0){
+        screenMarkRowsDirtyFrom(at);
+        return;
+    }
+    E.txmoved = E.txmoved == -1 ? at : imin(E.txmoved, at);
+    if (E.txlo > E.txhi) return;
+    if (count < 0 && at >= E.txlo && at <= E.txhi){
+        // a deleted row inside the range
+        E.txhi += count;
+    } else if (at <= E.txlo){
+        E.txlo += count;
+        E.txhi += count;
+    } else if (at <= E.txhi){
+        E.txhi += count;
+    }
+}
+
+// insert count rows at once, the gap is moved a single time for all of them
+void editorInsertRows(int at, char **lines, size_t *lens, int count){
+    if (at < 0 || at > E.numrows || count <= 0) return;
+
+    undoRows(UNDO_INSERT_ROWS, at, lines, lens, count);
+    editorReserveRows(E.numrows+count);
+    editorMoveRowGap(at);
+    editorRowsMoved(at, count);
+    int j;
+    for (j = 0; j < count; j++){
+        // the first gap slot becomes the new row
+        erow *row = &E.row[E.rowgap++];
+        E.numrows++;
+        size_t len = lens[j];
+
+        row->size = len;
+        row->chars = arenaAlloc(&E.arena, len+1, &row->cap);
+        memcpy(row->chars, lines[j], len);
+        row->chars[len] = '\0';
+
+        row->rsize = 0;
+        row->rcap = 0;
+        row->render = NULL;
+        row->stale = 0;
+        row->shared = 0;
+        row->tabs = NULL;
+        row->ntabs = row->tabcap = 0;
+        row->indexed = 0;
+        row->hl = NULL;
+        row->hlcap = 0;
+        row->hlknown = row->hlready = 0;
+        memset(&row->br, 0, sizeof(row->br));
+        row->words = 1;
+        row->skipped = 0;
+        editorRowLearnWords(row, 0, len);
+        editorUpdateRow(row);
+    }
+    layoutUpdate();
+
+    editorMarkModified();
+}
+
+void editorInsertRow(int at, char *s, size_t len){
+    editorInsertRows(at, &s, &len, 1);
 }
 
 void editorFreeRow(erow *row){
-    free(row->render);
-    free(row->chars);
+    arenaFree(&E.arena, row->render, row->rcap);
+    arenaFree(&E.arena, (char *)row->hl, row->hlcap);
+    arenaFree(&E.arena, (char *)row->tabs, row->tabcap);
+    if (row->shared && E.save) editorBury(row->chars, row->cap);
+    else arenaFree(&E.arena, row->chars, row->cap);
 }
 
 void editorDelRow(int at){
     if (at < 0 || at >= E.numrows) return;
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows-at-1));
+    // the row right after the gap is folded into the gap
+    editorMoveRowGap(at);
+    erow *row = editorRowAt(at);
+    size_t len = row->size;
+    undoRows(UNDO_DELETE_ROWS, at, &row->chars, &len, 1);
+    editorRowForgetWords(row, 0, row->size);
+    editorFreeRow(row);
+    bracketTreeSet(row - E.row, (struct bracketSum){0, 0, 0});
     E.numrows--;
-    E.dirty++;
+    editorRowsMoved(at, -1);
+    editorMarkModified();
 }
 
 void editorRowInsertChar(erow *row, int at, int c){
     if (at < 0 || at > row->size) at = row->size;
-    row->chars = realloc(row->chars, row->size+2); // 1 extra byte for NULL Character
+    editorRowReserve(row, row->size+2); // 1 extra byte for NULL Character
+    char ch = c;
+    undoSplice(row, at, NULL, 0, &ch, 1);
+    editorRowForgetWords(row, at, 0);
     // Copy N bytes of SRC to DEST, guaranteeing correct behavior for overlapping strings.
     memmove(&row->chars[at+1], &row->chars[at], row->size-at+1);
     row->size++;
     row->chars[at] = c;
+    editorRowTabsInserted(row, at, 1);
+    editorRowLearnWords(row, at, 1);
+    editorUpdateRow(row);
+    editorMarkModified();
+}
+
+void editorRowInsertString(erow *row, int at, const char *s, size_t len){
+    if (at < 0 || at > row->size) at = row->size;
+    editorRowReserve(row, row->size+len+1);
+    undoSplice(row, at, NULL, 0, s, len);
+    editorRowForgetWords(row, at, 0);
+    memmove(&row->chars[at+len], &row->chars[at], row->size-at+1);
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+    editorRowTabsInserted(row, at, len);
+    editorRowLearnWords(row, at, len);
     editorUpdateRow(row);
-    E.dirty++;
+    editorMarkModified();
 }
 
 void editorRowAppendString(erow *row, char *s, size_t len){
-    row->chars = realloc(row->chars, row->size+len+1);
+    editorRowReserve(row, row->size+len+1);
+    undoSplice(row, row->size, NULL, 0, s, len);
+    editorRowForgetWords(row, row->size, 0);
     memcpy(&row->chars[row->size], s, len);
     row->size += len;
     row->chars[row->size] = '\0';
+    editorRowTabsInserted(row, row->size-len, len);
+    editorRowLearnWords(row, row->size-len, len);
     editorUpdateRow(row);
-    E.dirty++;
+    editorMarkModified();
 }
 
 void editorRowDelChar(erow *row, int at){
     if (at < 0 || at >= row->size) return;
+    editorRowReserve(row, row->size+1);
     // Null byte gets included in memmove
     if ((row->chars[at] == '(' && at+1<row->size && row->chars[at+1] == ')')
         || (row->chars[at] == '{' && at+1<row->size && row->chars[at+1] == '}')
@@ -355,208 +2313,2905 @@ void editorRowDelChar(erow *row, int at){
         || (row->chars[at] == '"' && at+1<row->size && row->chars[at+1] == '"')){
         editorRowDelChar(row, at+1);
     } 
+    undoSplice(row, at, &row->chars[at], 1, NULL, 0);
+    editorRowForgetWords(row, at, 1);
     memmove(&row->chars[at], &row->chars[at+1], row->size-at);
     row->size--;
+    editorRowTabsDeleted(row, at, 1);
+    editorRowLearnWords(row, at, 0);
     editorUpdateRow(row);
-    E.dirty++;
+    editorMarkModified();
 }
 
-/* Editor Operations */
+// dlen bytes at chars[at] become the len bytes of s
+void editorRowSplice(erow *row, int at, int dlen, const char *s, int len){
+    editorRowReserve(row, row->size-dlen+len+1);
+    undoSplice(row, at, &row->chars[at], dlen, s, len);
+    editorRowForgetWords(row, at, dlen);
+    editorRowTabsDeleted(row, at, dlen);
+    memmove(&row->chars[at+len], &row->chars[at+dlen], row->size-at-dlen+1);
+    memcpy(&row->chars[at], s, len);
+    row->size += len-dlen;
+    editorRowTabsInserted(row, at, len);
+    editorRowLearnWords(row, at, len);
+    editorUpdateRow(row);
+    editorMarkModified();
+}
 
-void editorInsertChar(int c){
-    if (E.cy == E.numrows){
-        editorInsertRow(E.numrows, "", 0);
-    }
-    editorRowInsertChar(&E.row[E.cy], (E.cx-countDigits(E.numrows)), c);
-    E.cx++;
+/* Edit Transactions */
+
+// A user action can call the row operations many times. Between
+// editorBeginEdit() and editorCommitEdit() they only mark rows stale, and
+// every touched row is rendered once at commit. Transactions nest.
+
+void editorBeginEdit(){
+    if (E.txdepth++ > 0) return;
+    U.group++;
+    U.bcx = E.cx;
+    U.bcy = E.cy;
+    E.txlo = INT_MAX;
+    E.txhi = -1;
+    E.txmoved = -1;
+    E.txdirty = 0;
 }
 
-void editorInsertNewLine(){
-    erow *row = &E.row[E.cy];
-    int tabs = 0, j = 0;
-    while (row->chars[j] != '\0' && row->chars[j] == '\t')
-    {
-        tabs++;
-        j++;
+void editorCommitEdit(){
+    if (--E.txdepth > 0) return;
+    int j, hi = imin(E.txhi, E.numrows-1);
+    for (j = imax(E.txlo, 0); j <= hi; j++){
+        erow *row = editorRowAt(j);
+        if (row->stale) editorRenderRow(row);
     }
-
-    if ((E.cx-countDigits(E.numrows)) == 0){
-        editorInsertRow(E.cy, "", 0);
-    } else {
-        editorInsertRow(E.cy+1, &row->chars[(E.cx-countDigits(E.numrows))], row->size-(E.cx-countDigits(E.numrows)));
-        row = &E.row[E.cy];
-        row->size = (E.cx-countDigits(E.numrows));
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+    if (E.txmoved != -1) screenMarkRowsDirtyFrom(E.txmoved);
+    if (E.txdirty) E.dirty++;
+    if (U.touched){
+        struct undoOp *op = (struct undoOp *)&U.log[U.last];
+        op->acx = E.cx;
+        op->acy = E.cy;
+        U.touched = 0;
     }
-    E.cy++;
-    E.cx = countDigits(E.numrows);
-    while(tabs--) editorInsertChar('\t');
+}
+
+/* Undo */
+
+// The row operations record what they change in an append-only journal. A
+// run of typed characters or of deletes is folded into one record, a paste
+// is recorded once per row operation it makes, a replace-all as one record
+// of every row it rewrote. Undo walks
+// back over the records of one key, so it costs as much as that key did.
+
+static struct undoOp *undoAt(long off){
+    return (struct undoOp *)&U.log[off];
+}
+
+// offset the record after off starts at
+static long undoNext(long off){
+    long end = off + sizeof(struct undoOp) + undoAt(off)->bytes;
+    return (end+7) & ~7L;
+}
+
+// the next edit starts a record of its own, undoing it brings the cursor back here
+void undoBreak(){
+    U.touch = -1;
+    U.bcx = E.cx;
+    U.bcy = E.cy;
+}
+
+void undoClear(){
+    free(U.log);
+    U.log = NULL;
+    U.cap = U.start = U.end = 0;
+    U.last = U.top = -1;
+    U.touch = U.lost = -1;
+    U.touched = 0;
+}
+
+// group the records of the current key go to, a key that went on with the
+// newest record of the one before joins its group
+static int undoGroup(){
+    return U.touch == U.group && U.last >= 0 ? undoAt(U.last)->group : U.group;
+}
+
+// make room for need more bytes at the end, dropping the oldest keys while
+// the journal is over its limit. The key being recorded is never dropped,
+// neither is the group of the newest record when keep is set.
+static int undoRoom(long need, int keep){
+    int current = keep && U.last >= 0 ? undoAt(U.last)->group : undoGroup();
+    while (U.last >= 0 && U.end - U.start + need > CPEDI_UNDO_LIMIT){
+        int group = undoAt(U.start)->group;
+        if (group == current) return 0;
+        while (U.last >= 0 && undoAt(U.start)->group == group){
+            if (U.start == U.last){
+                U.start = U.end = 0;
+                U.last = U.top = -1;
+            } else {
+                U.start = undoNext(U.start);
+            }
+        }
+    }
+    if (need > CPEDI_UNDO_LIMIT) return 0;
+    if (U.end + need + 8 <= U.cap) return 1;
+    if (U.start > 0){
+        memmove(U.log, &U.log[U.start], U.end - U.start);
+        U.end -= U.start;
+        if (U.last >= 0) U.last -= U.start;
+        if (U.top >= 0) U.top -= U.start;
+        U.start = 0;
+    }
+    if (U.end + need + 8 > U.cap){
+        U.cap = imax(imax(U.cap*2, U.end + need + 8), 4096);
+        U.log = realloc(U.log, U.cap);
+        if (U.log == NULL) die("undoRoom: out of memory");
+    }
+    return 1;
+}
+
+// a new record carrying bytes, NULL if the key is not recorded
+static struct undoOp *undoAppend(int kind, int row, int at, long bytes){
+    // an edit after an undo drops what could have been redone
+    if (U.top != U.last){
+        if (U.top < 0){
+            U.start = U.end = 0;
+            U.last = -1;
+        } else {
+            U.end = U.top + sizeof(struct undoOp) + undoAt(U.top)->bytes;
+            U.last = U.top;
+        }
+    }
+    long need = sizeof(struct undoOp) + bytes;
+    if (!undoRoom(need, 0)){
+        // a single key bigger than the journal makes everything before it useless
+        undoClear();
+        U.lost = U.group;
+        return NULL;
+    }
+    int group = undoGroup();
+    long off = (U.end+7) & ~7L;
+    struct undoOp *op = undoAt(off);
+    op->prev = U.last >= 0 ? off - U.last : 0;
+    op->group = group;
+    op->kind = kind;
+    op->back = 0;
+    op->row = row;
+    op->at = at;
+    op->dlen = op->ilen = op->count = 0;
+    op->bytes = bytes;
+    op->bcx = U.bcx;
+    op->bcy = U.bcy;
+    op->acx = E.cx;
+    op->acy = E.cy;
+    U.last = U.top = off;
+    U.end = off + need;
+    U.touch = U.group;
+    U.touched = 1;
+    return op;
+}
+
+// the newest record gets len more bytes, NULL if they do not fit
+static char *undoExtend(int len){
+    if (!undoRoom(len, 1)) return NULL;
+    struct undoOp *op = undoAt(U.last);
+    char *p = (char *)(op+1) + op->bytes;
+    op->bytes += len;
+    U.end += len;
+    U.touch = U.group;
+    U.touched = 1;
+    return p;
+}
+
+// the newest record if the key before or this one wrote it and nothing was undone since
+static struct undoOp *undoMergeable(int kind, int row){
+    if (U.last < 0 || U.top != U.last || U.touch < U.group-1) return NULL;
+    struct undoOp *op = undoAt(U.last);
+    return op->kind == kind && op->row == row ? op : NULL;
+}
+
+// dlen bytes at chars[at] of row are about to become the ilen bytes of ins
+void undoSplice(erow *row, int at, const char *del, int dlen, const char *ins, int ilen){
+    if (U.mute || U.lost == U.group || (dlen == 0 && ilen == 0)) return;
+    int r = editorRowIndex(row);
+    struct undoOp *op = undoMergeable(UNDO_SPLICE, r);
+    char *p;
+    if (op && dlen == 0 && op->dlen == 0 && at == op->at + op->ilen){
+        // typing on
+        if ((p = undoExtend(ilen)) != NULL){
+            memcpy(p, ins, ilen);
+            undoAt(U.last)->ilen += ilen;
+            return;
+        }
+    } else if (op && ilen == 0 && op->ilen == 0 && !op->back && at == op->at){
+        // deleting forward
+        if ((p = undoExtend(dlen)) != NULL){
+            memcpy(p, del, dlen);
+            undoAt(U.last)->dlen += dlen;
+            return;
+        }
+    } else if (op && ilen == 0 && op->ilen == 0 && dlen == 1 && (op->back || op->dlen == 1) && at == op->at-1){
+        // backspacing, the bytes are kept in the order they went
+        if ((p = undoExtend(1)) != NULL){
+            *p = *del;
+            op = undoAt(U.last);
+            op->back = 1;
+            op->dlen++;
+            op->at--;
+            return;
+        }
+    }
+    op = undoAppend(UNDO_SPLICE, r, at, (long)dlen + ilen);
+    if (op == NULL) return;
+    op->dlen = dlen;
+    op->ilen = ilen;
+    if (dlen) memcpy(op+1, del, dlen);
+    if (ilen) memcpy((char *)(op+1) + dlen, ins, ilen);
+}
+
+// count rows are about to be inserted at row at, or the one at row at deleted
+void undoRows(int kind, int at, char **lines, size_t *lens, int count){
+    if (U.mute || U.lost == U.group) return;
+    long bytes = 0;
+    int j;
+    for (j = 0; j < count; j++) bytes += sizeof(int) + lens[j];
+    // rows deleted one after another by the same key go together
+    struct undoOp *op = undoMergeable(kind, at);
+    char *p = NULL;
+    if (kind == UNDO_DELETE_ROWS && op && U.touch == U.group && (p = undoExtend(bytes)) != NULL){
+        op = undoAt(U.last);
+    } else {
+        op = undoAppend(kind, at, 0, bytes);
+        if (op == NULL) return;
+        p = (char *)(op+1);
+    }
+    op->count += count;
+    for (j = 0; j < count; j++){
+        int len = lens[j];
+        memcpy(p, &len, sizeof(int));
+        memcpy(p + sizeof(int), lines[j], len);
+        p += sizeof(int) + len;
+    }
+}
+
+// the rows of edits are about to get their new text, recorded as one batch.
+// 0 if the batch is bigger than the journal, which is dropped with it.
+int undoSetRows(struct rowEdit *edits, int count){
+    if (U.mute || U.lost == U.group) return U.mute > 0;
+    long bytes = 0;
+    int j;
+    for (j = 0; j < count; j++) bytes += 3*sizeof(int) + editorRowAt(edits[j].row)->size + edits[j].len;
+    struct undoOp *op = undoAppend(UNDO_SET_ROWS, count ? edits[0].row : 0, 0, bytes);
+    if (op == NULL) return 0;
+    op->count = count;
+    char *p = (char *)(op+1);
+    for (j = 0; j < count; j++){
+        erow *row = editorRowAt(edits[j].row);
+        int head[3] = {edits[j].row, row->size, edits[j].len};
+        memcpy(p, head, sizeof(head));
+        memcpy(p + sizeof(head), row->chars, row->size);
+        memcpy(p + sizeof(head) + row->size, edits[j].chars, edits[j].len);
+        p += sizeof(head) + row->size + edits[j].len;
+    }
+    return 1;
+}
+
+// the rows a record carries, inserted at its row
+static void undoInsertRows(struct undoOp *op){
+    char **lines = malloc(sizeof(char *)*op->count);
+    size_t *lens = malloc(sizeof(size_t)*op->count);
+    if (lines == NULL || lens == NULL) die("undoInsertRows: out of memory");
+    char *p = (char *)(op+1);
+    int j, len;
+    for (j = 0; j < op->count; j++){
+        memcpy(&len, p, sizeof(int));
+        lines[j] = p + sizeof(int);
+        lens[j] = len;
+        p += sizeof(int) + len;
+    }
+    editorInsertRows(op->row, lines, lens, op->count);
+    free(lines);
+    free(lens);
+}
+
+// the edit of a record done again, or taken back
+static void undoApply(struct undoOp *op, int redo){
+    if (op->kind == UNDO_SPLICE){
+        char *del = (char *)(op+1), *ins = del + op->dlen;
+        erow *row = editorRowAt(op->row);
+        if (redo){
+            editorRowSplice(row, op->at, op->dlen, ins, op->ilen);
+            return;
+        }
+        char *text = del;
+        if (op->back){
+            text = malloc(op->dlen);
+            if (text == NULL) die("undoApply: out of memory");
+            int j;
+            for (j = 0; j < op->dlen; j++) text[j] = del[op->dlen-1-j];
+        }
+        editorRowSplice(row, op->at, op->ilen, text, op->dlen);
+        if (text != del) free(text);
+    } else if (op->kind == UNDO_SET_ROWS){
+        char *p = (char *)(op+1);
+        int j, head[3];
+        for (j = 0; j < op->count; j++){
+            memcpy(head, p, sizeof(head));
+            char *old = p + sizeof(head), *new = old + head[1];
+            erow *row = editorRowAt(head[0]);
+            editorRowSplice(row, 0, row->size, redo ? new : old, redo ? head[2] : head[1]);
+            p = new + head[2];
+        }
+    } else if ((op->kind == UNDO_INSERT_ROWS) == redo){
+        undoInsertRows(op);
+    } else {
+        int j;
+        for (j = 0; j < op->count; j++) editorDelRow(op->row);
+    }
+}
+
+void editorUndo(){
+    if (U.top < 0){
+        editorSetStatusMessage("Nothing to undo");
+        return;
+    }
+    U.mute++;
+    int group = undoAt(U.top)->group;
+    while (U.top >= 0 && undoAt(U.top)->group == group){
+        struct undoOp *op = undoAt(U.top);
+        undoApply(op, 0);
+        E.cx = op->bcx;
+        E.cy = op->bcy;
+        U.top = U.top == U.start ? -1 : U.top - op->prev;
+    }
+    U.mute--;
+    U.touch = -1;
+    E.cy = imin(E.cy, E.numrows);
+    E.cx = imin(E.cx, getRowLength());
+}
+
+void editorRedo(){
+    long next = U.top < 0 ? (U.last >= 0 ? U.start : -1) : (U.top == U.last ? -1 : undoNext(U.top));
+    if (next < 0){
+        editorSetStatusMessage("Nothing to redo");
+        return;
+    }
+    U.mute++;
+    int group = undoAt(next)->group;
+    while (next >= 0 && undoAt(next)->group == group){
+        struct undoOp *op = undoAt(next);
+        undoApply(op, 1);
+        E.cx = op->acx;
+        E.cy = op->acy;
+        U.top = next;
+        next = next == U.last ? -1 : undoNext(next);
+    }
+    U.mute--;
+    U.touch = -1;
+    E.cy = imin(E.cy, E.numrows);
+    E.cx = imin(E.cx, getRowLength());
+}
+
+/* Editor Operations */
+
+void editorInsertChar(int c){
+    editorLoadRowsUntil(E.cy+1);
+    if (E.cy == E.numrows){
+        editorInsertRow(E.numrows, "", 0);
+    }
+    editorRowInsertChar(editorRowAt(E.cy), E.cx, c);
+    E.cx++;
+}
+
+void editorInsertNewLine(){
+    editorLoadRowsUntil(E.cy+1);
+    if (E.cy == E.numrows){
+        editorInsertRow(E.numrows, "", 0);
+    }
+    editorBeginEdit();
+    erow *row = editorRowAt(E.cy);
+    int tabs = 0, j = 0;
+    while (j < row->size && row->chars[j] == '\t')
+    {
+        tabs++;
+        j++;
+    }
+
+    if (E.cx == 0){
+        editorInsertRow(E.cy, "", 0);
+    } else {
+        editorInsertRow(E.cy+1, &row->chars[E.cx], row->size-E.cx);
+        row = editorRowAt(E.cy);
+        editorRowReserve(row, row->size+1);
+        undoSplice(row, E.cx, &row->chars[E.cx], row->size-E.cx, NULL, 0);
+        editorRowForgetWords(row, E.cx, row->size-E.cx);
+        editorRowTabsDeleted(row, E.cx, row->size-E.cx);
+        row->size = E.cx;
+        row->chars[row->size] = '\0';
+        editorRowLearnWords(row, E.cx, 0);
+        editorUpdateRow(row);
+    }
+    E.cy++;
+    E.cx = 0;
+    // carry the indentation over in one insert
+    if (tabs){
+        char indent[tabs];
+        memset(indent, '\t', tabs);
+        editorRowInsertString(editorRowAt(E.cy), 0, indent, tabs);
+        E.cx += tabs;
+    }
+    editorCommitEdit();
 }
 
 void editorDelChar(){
+    editorLoadRowsUntil(E.cy+1);
     if (E.cy == E.numrows) return;
-    if ((E.cx-countDigits(E.numrows)) == 0 && E.cy == 0) return;
+    if (E.cx == 0 && E.cy == 0) return;
 
-    erow *row = &E.row[E.cy];
-    if ((E.cx-countDigits(E.numrows)) > 0){
-        editorRowDelChar(row, (E.cx-countDigits(E.numrows)) - 1);
+    erow *row = editorRowAt(E.cy);
+    if (E.cx > 0){
+        editorRowDelChar(row, E.cx - 1);
         E.cx--;
     } else {
-        E.cx = countDigits(E.numrows) + E.row[E.cy-1].size;
-        editorRowAppendString(&E.row[E.cy-1], row->chars, row->size);
+        erow *prev = editorRowAt(E.cy-1);
+        E.cx = prev->size;
+        editorRowAppendString(prev, row->chars, row->size);
         editorDelRow(E.cy);
         E.cy--;
     }
 }
 
+// insert text at the cursor as it is, without the auto pairs and indentation
+// of typed keys. Every line after the first becomes a row in one splice.
+void editorInsertText(const char *s, size_t len){
+    editorLoadRowsUntil(E.cy+1);
+    if (E.cy == E.numrows){
+        editorInsertRow(E.numrows, "", 0);
+    }
+
+    // terminals send \r for newlines, \r\n is a single newline
+    char *text = malloc(len+1);
+    size_t n = 0, i;
+    int nlines = 1;
+    for (i = 0; i < len; i++){
+        if (s[i] == '\r' || s[i] == '\n'){
+            if (s[i] == '\r' && i+1 < len && s[i+1] == '\n') i++;
+            text[n++] = '\n';
+            nlines++;
+        } else {
+            text[n++] = s[i];
+        }
+    }
+
+    erow *row = editorRowAt(E.cy);
+    int at = E.cx;
+    if (nlines == 1){
+        editorRowInsertString(row, at, text, n);
+        E.cx += n;
+        free(text);
+        return;
+    }
+    editorBeginEdit();
+
+    char **lines = malloc(sizeof(char *)*nlines);
+    size_t *lens = malloc(sizeof(size_t)*nlines);
+    int j = 0;
+    char *p = text, *end = text+n;
+    while (j < nlines){
+        char *nl = memchr(p, '\n', end-p);
+        lines[j] = p;
+        lens[j] = nl ? (size_t)(nl-p) : (size_t)(end-p);
+        p = nl ? nl+1 : end;
+        j++;
+    }
+
+    // the rest of the cursor row moves behind the last line
+    int taillen = row->size - at;
+    char *last = malloc(lens[nlines-1] + taillen);
+    memcpy(last, lines[nlines-1], lens[nlines-1]);
+    memcpy(&last[lens[nlines-1]], &row->chars[at], taillen);
+    int lastlen = lens[nlines-1];
+    lines[nlines-1] = last;
+    lens[nlines-1] += taillen;
+
+    // the row is cut at at only after this, it still holds all of its chars
+    editorRowReserve(row, imax(row->size, at + lens[0]) + 1);
+    undoSplice(row, at, &row->chars[at], taillen, lines[0], lens[0]);
+    editorRowForgetWords(row, at, taillen);
+    editorRowTabsDeleted(row, at, taillen);
+    memcpy(&row->chars[at], lines[0], lens[0]);
+    row->size = at + lens[0];
+    row->chars[row->size] = '\0';
+    editorRowTabsInserted(row, at, lens[0]);
+    editorRowLearnWords(row, at, lens[0]);
+    editorUpdateRow(row);
+    editorMarkModified();
+    editorInsertRows(E.cy+1, &lines[1], &lens[1], nlines-1);
+
+    E.cy += nlines-1;
+    E.cx = lastlen;
+    editorCommitEdit();
+    free(last);
+    free(lines);
+    free(lens);
+    free(text);
+}
+
+// move to the end of line l, 0 if there is no such line
+int editorTeleportTo(int l){
+    // The lines on the way become rows cut from the line index, their words
+    // are learned once drawn and the lexer starts just above the target.
+    // What is left per line is its erow.
+    editorSkipRowsUntil(l - E.screenrows);
+    editorLoadRowsUntil(l);
+    if (l < 1 || l > E.numrows) return 0;
+    E.cy = l-1;
+    E.cx = getRowLength();
+    return 1;
+}
+
 void editorTeleport(){
-    char *line = editorPrompt("Line Number : %s");
-    int l = atoi(line);
-    if (l < E.numrows){
-        E.cy = l-1;
-        E.cx = countDigits(E.numrows)+getRowLength();
+    char *line = editorPrompt("Line Number : %s", NULL);
+    if (line == NULL) return;
+    editorTeleportTo(atoi(line));
+    free(line);
+}
+
+/* Search */
+
+// first occurrence of needle in hay. Candidates are positions where both the
+// first and the last byte of needle match, 32 or 16 of them are tested at
+// once and only those get a memcmp().
+const char *findBytes(const char *hay, size_t n, const char *needle, size_t m){
+    if (m == 0) return hay;
+    if (n < m) return NULL;
+    if (m == 1) return memchr(hay, needle[0], n);
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[m-1]);
+    for (; i + m-1 + 32 <= n; i += 32){
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(hay+i)), first);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(hay+i+m-1)), last);
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+        while (mask){
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(hay+at+1, needle+1, m-2) == 0) return hay+at;
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[m-1]);
+    for (; i + m-1 + 16 <= n; i += 16){
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(hay+i)), first);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(hay+i+m-1)), last);
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+        while (mask){
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(hay+at+1, needle+1, m-2) == 0) return hay+at;
+            mask &= mask - 1;
+        }
     }
+#endif
+    // the tail, or everything without SIMD, goes to the two-way memmem()
+    return memmem(hay+i, n-i, needle, m);
 }
 
-// This function is written by Claude AI as the earlier version of this function was not suitable for copying
-// characters involved in the code, not sure what sorcery it did here, something realted to xclip - linux
-void editorCopyToClipboard(const char *text, int len) {
-    // Create a pipe for communication with xclip
-    int pipefd[2];
-    if (pipe(pipefd) == -1) {
-        perror("pipe");
-        return;
+// column of the first match in the row at or after from, -1 if none
+int editorRowFind(erow *row, int from, const char *q, size_t len){
+    if (from > row->size) return -1;
+    const char *p = findBytes(&row->chars[from], row->size-from, q, len);
+    return p ? (int)(p - row->chars) : -1;
+}
+
+// column of the last match in the row that starts before to, -1 if none
+int editorRowFindBefore(erow *row, int to, const char *q, size_t len){
+    int at = -1, next = 0;
+    while ((next = editorRowFind(row, next, q, len)) != -1 && next < to){
+        at = next;
+        next++;
     }
-    
-    pid_t pid = fork();
-    if (pid == -1) {
-        perror("fork");
-        close(pipefd[0]);
-        close(pipefd[1]);
+    return at;
+}
+
+// Going back from the end of the buffer, look for the last match in the
+// part of the mapped file that is not rows yet, before offset hi. Only the
+// rows up to a match get loaded. 1 if there is one, in F.row and F.col, 0
+// if there is none, -1 if a key stopped the scan at F.scantail.
+static int editorFindMappedBack(size_t hi, size_t *scanned){
+    while (hi > E.mapoff){
+        size_t lo = hi - E.mapoff > CPEDI_SEARCH_CHECK ? hi - CPEDI_SEARCH_CHECK : E.mapoff;
+        // pieces start at a line so none of them cuts a match in two
+        if (lo > E.mapoff){
+            char *nl = memrchr(&E.map[E.mapoff], '\n', lo - E.mapoff);
+            lo = nl ? (size_t)(nl+1 - E.map) : E.mapoff;
+        }
+        const char *p = &E.map[lo], *end = &E.map[hi], *hit = NULL, *q;
+        while ((q = findBytes(p, end - p, F.query, F.len)) != NULL){
+            hit = q;
+            p = q+1;
+        }
+        if (hit){
+            size_t off = hit - E.map;
+            char *nl = memrchr(&E.map[E.mapoff], '\n', off - E.mapoff);
+            size_t start = nl ? (size_t)(nl+1 - E.map) : E.mapoff;
+            while (E.mapoff <= start && !editorFullyLoaded()) editorLoadRowsUntil(E.numrows+1);
+            F.row = E.numrows-1;
+            F.col = off - start;
+            return 1;
+        }
+        *scanned += hi - lo;
+        hi = lo;
+        if (*scanned >= CPEDI_SEARCH_CHECK){
+            *scanned = 0;
+            if (hi > E.mapoff && editorInputPending()){
+                F.scanrow = E.numrows;
+                F.scandir = -1;
+                F.scantail = hi;
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Look for F.query starting at (row, col) in direction dir, wrapping around
+// the buffer once. Forward, a match may start at col, backward it has to
+// start before it. Rows of a mapped file are loaded as the scan reaches them,
+// going back from the end the file is searched as it is and only loaded up to
+// the match. A key arriving during a long scan stops it, 0 is returned and the
+// scan can be picked up again from F.scanrow.
+int editorFindFrom(int row, int col, int dir){
+    size_t scanned = 0, tail = F.scantail;
+    F.scanrow = -1;
+    F.scantail = 0;
+    editorLoadRowsUntil(imax(row+1, 1));
+    if (E.numrows == 0) return 0;
+    // the rest of the file was already searched when the scan started there
+    int fromtail = row < 0 || tail > E.mapoff;
+    if (fromtail){
+        int found = editorFindMappedBack(tail > E.mapoff ? tail : E.maplen, &scanned);
+        if (found != 0) return found > 0;
+        row = E.numrows-1;
+        col = INT_MAX;
+    } else if (row >= E.numrows){
+        row = col = 0;
+    }
+    int r = row, wrapped = 0;
+    while (1){
+        if (r >= E.numrows) editorLoadRowsUntil(r + CPEDI_SEARCH_LOAD);
+        if (r >= E.numrows){
+            r = 0;
+            wrapped = 1;
+        }
+        if (r < 0){
+            if (!fromtail){
+                int found = editorFindMappedBack(E.maplen, &scanned);
+                if (found != 0) return found > 0;
+            }
+            r = E.numrows-1;
+            wrapped = 1;
+        }
+        if (wrapped && r == row){
+            // the part of the start row that was skipped at the beginning
+            erow *last = editorRowAt(r);
+            int at = dir > 0 ? editorRowFind(last, 0, F.query, F.len)
+                             : editorRowFindBefore(last, INT_MAX, F.query, F.len);
+            if (at == -1 || (dir > 0 ? at >= col : at < col)) return 0;
+            F.row = r;
+            F.col = at;
+            return 1;
+        }
+
+        erow *cur = editorRowAt(r);
+        int at;
+        if (r == row && !wrapped){
+            at = dir > 0 ? editorRowFind(cur, col, F.query, F.len)
+                         : editorRowFindBefore(cur, col, F.query, F.len);
+        } else {
+            at = dir > 0 ? editorRowFind(cur, 0, F.query, F.len)
+                         : editorRowFindBefore(cur, INT_MAX, F.query, F.len);
+        }
+        if (at != -1){
+            F.row = r;
+            F.col = at;
+            return 1;
+        }
+
+        scanned += cur->size + 1;
+        if (scanned >= CPEDI_SEARCH_CHECK){
+            scanned = 0;
+            if (editorInputPending()){
+                F.scanrow = r + dir;
+                F.scandir = dir;
+                return 0;
+            }
+        }
+        r += dir;
+    }
+}
+
+// overlay the matches of the search on line y of the back frame
+void editorDrawMatches(int y, erow *row, int filerow){
+    if (F.len == 0) return;
+    int at = 0;
+    while ((at = editorRowFind(row, at, F.query, F.len)) != -1){
+        int rx = editorRowCxtoRx(row, at) - E.coloff;
+        int rend = editorRowCxtoRx(row, at + F.len) - E.coloff;
+        unsigned char attr = (filerow == F.row && at == F.col) ? ATTR_INVERSE : ATTR_MATCH;
+        int x;
+        for (x = imax(rx, 0); x < rend && L.gutter + x < S.cols; x++){
+            S.back[y*S.cols + L.gutter + x].attr = attr;
+        }
+        if (L.gutter + rx >= S.cols) break;
+        at++;
+    }
+}
+
+void editorFindCallback(char *query, int key){
+    if (key == '\r' || key == '\x1b'){
+        if (key == '\x1b'){
+            E.cx = F.cx;
+            E.cy = F.cy;
+            E.rowoff = F.rowoff;
+            E.coloff = F.coloff;
+        }
+        F.active = 0;
+        screenMarkAllDirty();
         return;
     }
-    
-    if (pid == 0) {  // Child process
-        close(pipefd[1]);  // Close write end
-        
-        // Redirect stdin to read from pipe
-        dup2(pipefd[0], STDIN_FILENO);
-        close(pipefd[0]);
-        
-        // Execute xclip
-        execlp("xclip", "xclip", "-selection", "clipboard", NULL);
-        
-        // If we get here, exec failed
-        perror("execlp");
-        exit(EXIT_FAILURE);
-    } else {  // Parent process
-        close(pipefd[0]);  // Close read end
-        
-        // Write the text to the pipe
-        write(pipefd[1], text, len);
-        close(pipefd[1]);
-        
-        // Wait for child to finish
-        waitpid(pid, NULL, 0);
+
+    int dir = 1, row, col;
+    if (key == ARROW_RIGHT || key == ARROW_DOWN || key == ARROW_LEFT || key == ARROW_UP){
+        if (F.len == 0) return;
+        dir = (key == ARROW_RIGHT || key == ARROW_DOWN) ? 1 : -1;
+        if (F.scanrow != -1 && F.scandir == dir){
+            // carry on where the interrupted scan stopped
+            row = F.scanrow;
+            col = dir > 0 ? 0 : INT_MAX;
+        } else if (F.row != -1){
+            F.scantail = 0;
+            row = F.row;
+            col = dir > 0 ? F.col+1 : F.col;
+        } else {
+            F.scantail = 0;
+            row = F.cy;
+            col = F.cx;
+        }
+    } else {
+        size_t len = strlen(query);
+        if (len == F.len && memcmp(query, F.query, len) == 0) return;
+        free(F.query);
+        F.query = strdup(query);
+        F.len = len;
+        screenMarkAllDirty();
+        if (len == 0){
+            F.row = -1;
+            return;
+        }
+        // a longer or shorter query still matches where the last one did,
+        // so the scan starts there instead of at the top
+        F.scantail = 0;
+        row = F.row != -1 ? F.row : F.cy;
+        col = F.row != -1 ? F.col : F.cx;
+    }
+
+    int oldrow = F.row;
+    if (editorFindFrom(row, col, dir)){
+        E.cy = F.row;
+        E.cx = F.col;
+    } else if (F.scanrow == -1){
+        F.row = -1;
+    }
+    if (oldrow != F.row){
+        screenMarkRowDirty(oldrow);
+        screenMarkRowDirty(F.row);
     }
 }
 
-void editorCopyAll(){
-    int len;
-    char *buf = editorRowsToString(&len);
-    buf[len] = '\0';
-    editorCopyToClipboard(buf, len);
-    editorSetStatusMessage("Copied to Clipboard Successfully: %d", len);
+void editorFind(){
+    F.active = 1;
+    F.query = NULL;
+    F.len = 0;
+    F.row = F.scanrow = -1;
+    F.scantail = 0;
+    F.cx = E.cx;
+    F.cy = E.cy;
+    F.rowoff = E.rowoff;
+    F.coloff = E.coloff;
+    char *query = editorPrompt("Search: %s (Arrows to move, ESC to cancel)", editorFindCallback);
+    free(query);
+    free(F.query);
+    F.query = NULL;
+    F.len = 0;
 }
 
-void editorCopyRow(int at){
-    int len = E.row[at].size;
-    char *buf = malloc(len);
-    memcpy(buf, E.row[at].chars, len);
-    editorCopyToClipboard(buf, len);
-    editorSetStatusMessage("Row Copied to Clipboard: %d", len);
+/* Replace */
+
+// Replace-all runs in two phases. Worker threads take chunks of rows and
+// build the new text of every row that matches, the rows themselves are not
+// touched. Then the main thread swaps the new text into those rows inside a
+// single edit transaction, so each changed row is rendered once.
+
+static void bufAppend(char **buf, int *len, int *cap, const char *s, int n){
+    if (*len + n + 1 > *cap){
+        *cap = imax(*len + n + 1, *cap*2);
+        *buf = realloc(*buf, *cap);
+        if (*buf == NULL) die("bufAppend: out of memory");
+    }
+    memcpy(&(*buf)[*len], s, n);
+    *len += n;
 }
-/* File i/o */
 
-char* editorRowsToString(int *buflen){
-    int totlen = 0;
+// new text of a row with every match replaced, \0-\9 in with are the groups
+// of the match. NULL if nothing matched.
+char *replaceRow(regex_t *re, const char *with, const char *s, int len, int *outlen, long *count){
+    char *out = NULL;
+    int olen = 0, ocap = 0, from = 0, prevend = -1;
+    regmatch_t m[10];
+    while (from <= len){
+        m[0].rm_so = from;
+        m[0].rm_eo = len;
+        // REG_STARTEND as rows are not terminated inside the mapped file,
+        // ^ and \b still see the bytes before from
+        if (regexec(re, s, 10, m, REG_STARTEND) != 0) break;
+        if (m[0].rm_eo == m[0].rm_so && m[0].rm_so == prevend){
+            // no empty match right behind the previous match, like sed
+            if (m[0].rm_so < len) bufAppend(&out, &olen, &ocap, &s[m[0].rm_so], 1);
+            from = m[0].rm_so + 1;
+            continue;
+        }
+        bufAppend(&out, &olen, &ocap, &s[from], m[0].rm_so - from);
+        const char *w;
+        for (w = with; *w; w++){
+            if (*w == '\\' && w[1] >= '0' && w[1] <= '9'){
+                int g = *++w - '0';
+                if (m[g].rm_so != -1) bufAppend(&out, &olen, &ocap, &s[m[g].rm_so], m[g].rm_eo - m[g].rm_so);
+            } else if (*w == '\\' && w[1] == '\\'){
+                bufAppend(&out, &olen, &ocap, ++w, 1);
+            } else {
+                bufAppend(&out, &olen, &ocap, w, 1);
+            }
+        }
+        (*count)++;
+        prevend = m[0].rm_eo;
+        if (m[0].rm_eo > m[0].rm_so){
+            from = m[0].rm_eo;
+        } else {
+            // an empty match, keep the next byte and look after it
+            if (m[0].rm_so < len) bufAppend(&out, &olen, &ocap, &s[m[0].rm_so], 1);
+            from = m[0].rm_so + 1;
+        }
+    }
+    if (out == NULL) return NULL;
+    if (from < len) bufAppend(&out, &olen, &ocap, &s[from], len - from);
+    *outlen = olen;
+    return out;
+}
+
+void *replaceThread(void *arg){
+    struct replaceJob *job = arg;
+    // glibc serializes regexec() calls on one regex_t, every worker compiles its own
+    regex_t re;
+    if (regcomp(&re, job->pattern, REG_EXTENDED) != 0) return NULL;
+    long count = 0;
+    int c;
+    while ((c = atomic_fetch_add(&job->next, 1)) < job->nchunks){
+        int cap = 0, j;
+        int lo = c*CPEDI_REPLACE_CHUNK, hi = imin(lo + CPEDI_REPLACE_CHUNK, E.numrows);
+        for (j = lo; j < hi; j++){
+            erow *row = editorRowAt(j);
+            int len;
+            char *chars = replaceRow(&re, job->with, row->chars, row->size, &len, &count);
+            if (chars == NULL) continue;
+            if (job->nedits[c] == cap){
+                cap = imax(16, cap*2);
+                job->edits[c] = realloc(job->edits[c], sizeof(struct rowEdit)*cap);
+                if (job->edits[c] == NULL) die("replaceThread: out of memory");
+            }
+            job->edits[c][job->nedits[c]++] = (struct rowEdit){j, chars, len};
+        }
+    }
+    regfree(&re);
+    atomic_fetch_add(&job->count, count);
+    return NULL;
+}
+
+// the whole text of the row becomes chars
+void editorRowSetChars(erow *row, const char *chars, int len){
+    editorRowReserve(row, len+1);
+    undoSplice(row, 0, row->chars, row->size, chars, len);
+    editorRowForgetWords(row, 0, row->size);
+    memcpy(row->chars, chars, len);
+    row->size = len;
+    row->chars[len] = '\0';
+    editorRowLearnWords(row, 0, len);
+    row->indexed = 0; // tabs are found again when the row is rendered
+    editorUpdateRow(row);
+    editorMarkModified();
+}
+
+void editorReplaceAll(){
+    char *pattern = editorPrompt("Replace (regex): %s (ESC to cancel)", NULL);
+    if (pattern == NULL) return;
+    regex_t re;
+    int err = regcomp(&re, pattern, REG_EXTENDED);
+    if (err != 0){
+        char msg[64];
+        regerror(err, &re, msg, sizeof(msg));
+        editorSetStatusMessage("Bad regex: %s", msg);
+        free(pattern);
+        return;
+    }
+    regfree(&re);
+    // an empty prompt cannot be confirmed, a lone \ stands for nothing
+    char *with = editorPrompt("Replace with: %s (\\ for nothing, ESC to cancel)", NULL);
+    if (with == NULL){
+        free(pattern);
+        return;
+    }
+    if (strcmp(with, "\\") == 0) with[0] = '\0';
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    editorLoadAllRows();
+
+    struct replaceJob job;
+    job.pattern = pattern;
+    job.with = with;
+    job.nchunks = (E.numrows + CPEDI_REPLACE_CHUNK-1) / CPEDI_REPLACE_CHUNK;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.count, 0);
+    job.edits = calloc(job.nchunks+1, sizeof(struct rowEdit *));
+    job.nedits = calloc(job.nchunks+1, sizeof(int));
+
+    // the main thread is one of the workers
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = imax(1, imin(imin(ncpu, CPEDI_REPLACE_THREADS), job.nchunks));
+    pthread_t threads[CPEDI_REPLACE_THREADS];
+    int j, started = 0;
+    for (j = 1; j < nthreads; j++){
+        if (pthread_create(&threads[started], NULL, replaceThread, &job) == 0) started++;
+    }
+    replaceThread(&job);
+    for (j = 0; j < started; j++) pthread_join(threads[j], NULL);
+
+    // chunks are in row order, so are their edits
+    int rows = 0, c, k;
+    for (c = 0; c < job.nchunks; c++) rows += job.nedits[c];
+    struct rowEdit *edits = malloc(sizeof(struct rowEdit)*imax(rows, 1));
+    if (edits == NULL) die("editorReplaceAll: out of memory");
+    for (c = 0, k = 0; c < job.nchunks; c++){
+        memcpy(&edits[k], job.edits[c], sizeof(struct rowEdit)*job.nedits[c]);
+        k += job.nedits[c];
+        free(job.edits[c]);
+    }
+    // one undo record for all of them, not one per row
+    editorBeginEdit();
+    int undoable = rows == 0 || undoSetRows(edits, rows);
+    U.mute++;
+    for (k = 0; k < rows; k++){
+        editorRowSetChars(editorRowAt(edits[k].row), edits[k].chars, edits[k].len);
+        free(edits[k].chars);
+    }
+    U.mute--;
+    E.cx = imin(E.cx, getRowLength());
+    editorCommitEdit();
+    free(edits);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double ms = (end.tv_sec-start.tv_sec)*1000.0 + (end.tv_nsec-start.tv_nsec)/1e6;
+    editorSetStatusMessage("Replaced %ld matches in %d rows, %.1f ms on %d threads%s",
+        (long)atomic_load(&job.count), rows, ms, started+1,
+        undoable ? "" : ", too big to undo");
+    free(job.edits);
+    free(job.nedits);
+    free(pattern);
+    free(with);
+}
+
+/* Completion */
+
+// walk the subtree of node, word holds the len bytes of the path to it. The
+// most frequent identifiers longer than the prefix are kept, at most
+// *budget nodes are looked at so a short prefix stays cheap.
+static void completeWalk(int node, char *word, int len, int *budget){
+    if (--*budget < 0 || T.node[node].below <= 0) return;
+    int count = T.node[node].count;
+    if (count > 0 && len > C.prefix){
+        int k = C.n < CPEDI_COMPLETIONS ? C.n++ : CPEDI_COMPLETIONS;
+        // insertion into the sorted suggestions, the least frequent falls off
+        while (k > 0 && C.count[k-1] < count){
+            if (k < CPEDI_COMPLETIONS){
+                memcpy(C.word[k], C.word[k-1], sizeof(C.word[k]));
+                C.count[k] = C.count[k-1];
+            }
+            k--;
+        }
+        if (k < CPEDI_COMPLETIONS){
+            memcpy(C.word[k], word, len);
+            C.word[k][len] = '\0';
+            C.count[k] = count;
+        }
+    }
+    if (len == CPEDI_IDENT_MAX) return;
     int j;
-    for (j = 0; j < E.numrows; j++){
-        totlen += E.row[j].size + 1;
+    for (j = T.node[node].child; j; j = T.node[j].next){
+        word[len] = T.node[j].c;
+        completeWalk(j, word, len+1, budget);
     }
-    *buflen = totlen;
+}
 
-    char *buf = malloc(totlen);
-    char *p = buf; // pointer to navigate buf string
-    for (j = 0; j < E.numrows; j++){
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+// suggestions for the identifier that ends at the cursor, shown in the message
+// bar while typing. Any other key takes them down.
+void editorSuggest(int typing){
+    C.n = 0;
+    if (typing && E.syntax && T.node && E.cy < E.numrows){
+        erow *row = editorRowAt(E.cy);
+        int start = E.cx;
+        while (start > 0 && isIdent((unsigned char)row->chars[start-1])) start--;
+        C.prefix = E.cx - start;
+        int atend = E.cx == row->size || !isIdent((unsigned char)row->chars[E.cx]);
+        if (atend && C.prefix >= 2 && C.prefix < CPEDI_IDENT_MAX && !isdigit((unsigned char)row->chars[start])){
+            int node = 0, j;
+            for (j = start; j < E.cx && (node = trieChild(node, row->chars[j], 0)); j++);
+            if (node){
+                char word[CPEDI_IDENT_MAX+1];
+                memcpy(word, &row->chars[start], C.prefix);
+                int budget = CPEDI_COMPLETE_VISIT;
+                completeWalk(node, word, C.prefix, &budget);
+            }
+        }
+    }
+    if (C.n > 0){
+        char msg[sizeof(E.statusmsg)];
+        int len = snprintf(msg, sizeof(msg), "^N:"), j;
+        for (j = 0; j < C.n && len < (int)sizeof(msg); j++){
+            len += snprintf(&msg[len], sizeof(msg)-len, " %s", C.word[j]);
+        }
+        editorSetStatusMessage("%s", msg);
+        C.shown = 1;
+    } else if (C.shown){
+        // only take down our own message
+        if (strncmp(E.statusmsg, "^N:", 3) == 0) editorSetStatusMessage("");
+        C.shown = 0;
+    }
+}
+
+// finish the identifier at the cursor with the first suggestion
+void editorComplete(){
+    if (C.n == 0) return;
+    const char *rest = C.word[0] + C.prefix;
+    editorInsertText(rest, strlen(rest));
+}
+
+/* Clipboard */
+
+// Cut and copied texts go to a kill ring that ^V pastes from, so they never
+// leave the process on the way back in. The newest one is also handed to the
+// system clipboard: a helper like xclip is spawned with a non-blocking pipe
+// that the input loop feeds, or without a display the terminal gets it as an
+// OSC 52 sequence. The editor never waits for either.
+
+char *CPEDI_CLIPBOARD_HELPERS[][4] = {
+    {"xclip", "-selection", "clipboard", NULL},
+    {"wl-copy", NULL},
+    {"xsel", "--clipboard", "--input", NULL},
+};
+
+// the text the terminal puts on its clipboard, base64 inside <esc>]52;c;...<bel>
+void clipboardOSC52(const char *text, size_t len){
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    if (len > CPEDI_OSC52_MAX) len = CPEDI_OSC52_MAX;
+    char *out = malloc(7 + (len+2)/3*4 + 1);
+    if (out == NULL) die("clipboardOSC52: out of memory");
+    memcpy(out, "\x1b]52;c;", 7);
+    size_t i, n = 7;
+    for (i = 0; i < len; i += 3){
+        unsigned v = (unsigned char)text[i] << 16;
+        if (i+1 < len) v |= (unsigned char)text[i+1] << 8;
+        if (i+2 < len) v |= (unsigned char)text[i+2];
+        out[n++] = digits[v >> 18];
+        out[n++] = digits[(v >> 12) & 63];
+        out[n++] = i+1 < len ? digits[(v >> 6) & 63] : '=';
+        out[n++] = i+2 < len ? digits[v & 63] : '=';
+    }
+    out[n++] = '\a';
+    editorWrite(out, n);
+    free(out);
+}
+
+int clipboardFd(){
+    return K.pid > 0 ? K.fd : -1;
+}
+
+int clipboardBusy(){
+    return K.pid > 0 || K.nreap > 0 || K.unsent;
+}
+
+// stop feeding the current helper, it is reaped once it exits
+static void clipboardDrop(){
+    if (K.pid <= 0) return;
+    if (K.fd != -1) close(K.fd);
+    kill(K.pid, SIGTERM);
+    if (K.nreap == K.reapcap){
+        K.reapcap = imax(16, K.reapcap*2);
+        K.reap = realloc(K.reap, sizeof(pid_t)*K.reapcap);
+        if (K.reap == NULL) die("clipboardDrop: out of memory");
+    }
+    K.reap[K.nreap++] = K.pid;
+    free(K.buf);
+    K.buf = NULL;
+    K.pid = 0;
+    K.fd = -1;
+}
+
+// start a helper reading the text from a pipe, 0 if none could be started
+static int clipboardSpawn(){
+    if (getenv("DISPLAY") == NULL && getenv("WAYLAND_DISPLAY") == NULL) return 0;
+    int nhelpers = sizeof(CPEDI_CLIPBOARD_HELPERS)/sizeof(CPEDI_CLIPBOARD_HELPERS[0]);
+    int k;
+    for (k = 0; k < nhelpers; k++){
+        // the one that worked last time is tried first
+        int h = K.helper >= 0 ? (K.helper + k) % nhelpers : k;
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) return 0;
+        posix_spawn_file_actions_t fa;
+        posix_spawn_file_actions_init(&fa);
+        posix_spawn_file_actions_adddup2(&fa, fds[0], STDIN_FILENO);
+        // whatever it prints would land on the screen
+        posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+        pid_t pid;
+        int err = posix_spawnp(&pid, CPEDI_CLIPBOARD_HELPERS[h][0], &fa, NULL, CPEDI_CLIPBOARD_HELPERS[h], environ);
+        posix_spawn_file_actions_destroy(&fa);
+        close(fds[0]);
+        if (err != 0){
+            close(fds[1]);
+            continue;
+        }
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        K.helper = h;
+        K.pid = pid;
+        K.fd = fds[1];
+        return 1;
+    }
+    K.helper = -1;
+    return 0;
+}
+
+// put text on the system clipboard, buf is taken over
+void clipboardSend(char *buf, size_t len){
+    clipboardDrop();
+    K.buf = buf;
+    K.len = len;
+    K.off = 0;
+    if (!clipboardSpawn()){
+        clipboardOSC52(buf, len);
+        free(buf);
+        K.buf = NULL;
+        return;
+    }
+    clipboardService();
+}
+
+// feed the helper what its pipe takes and reap the helpers that exited
+void clipboardService(){
+    while (K.fd != -1 && K.off < K.len){
+        ssize_t n = write(K.fd, &K.buf[K.off], K.len - K.off);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) break;
+        if (n <= 0){
+            // it went away before reading everything, it is judged when reaped
+            K.off = K.len + 1;
+            break;
+        }
+        K.off += n;
+    }
+    if (K.fd != -1 && K.off >= K.len){
+        close(K.fd); // end of file for the helper
+        K.fd = -1;
+    }
+
+    int j = 0, status;
+    while (j < K.nreap){
+        if (waitpid(K.reap[j], &status, WNOHANG) == 0) j++;
+        else K.reap[j] = K.reap[--K.nreap];
+    }
+    if (K.pid <= 0 || K.fd != -1 || waitpid(K.pid, &status, WNOHANG) == 0) return;
+    if (K.off > K.len || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        clipboardOSC52(K.buf, K.len);
+        editorSetStatusMessage("%s failed, sent %zu bytes through the terminal instead",
+            CPEDI_CLIPBOARD_HELPERS[K.helper][0], K.len);
+        I.woken = 1;
+    }
+    free(K.buf);
+    K.buf = NULL;
+    K.pid = 0;
+}
+
+// the newest kill ring entry goes to the system clipboard. A run of cuts
+// sends it once, after the first other key or once the keys stop coming
+void clipboardFlush(){
+    if (!K.unsent) return;
+    K.unsent = 0;
+    // the system clipboard gets its own copy, the ring can drop the entry while it is sent
+    char *buf = malloc(K.ringlen[K.head]);
+    if (buf == NULL && K.ringlen[K.head] > 0) die("clipboardFlush: out of memory");
+    memcpy(buf, K.ring[K.head], K.ringlen[K.head]);
+    clipboardSend(buf, K.ringlen[K.head]);
+}
+
+// text becomes the newest kill ring entry, or is added to it
+void killRingPush(const char *text, size_t len, int append){
+    if (!append || K.n == 0){
+        K.head = (K.head + 1) % CPEDI_KILL_RING;
+        if (K.n < CPEDI_KILL_RING) K.n++;
+        free(K.ring[K.head]);
+        K.ring[K.head] = NULL;
+        K.ringlen[K.head] = 0;
+    }
+    char *entry = realloc(K.ring[K.head], K.ringlen[K.head] + len);
+    if (entry == NULL && K.ringlen[K.head] + len > 0) die("killRingPush: out of memory");
+    memcpy(&entry[K.ringlen[K.head]], text, len);
+    K.ring[K.head] = entry;
+    K.ringlen[K.head] += len;
+    K.unsent = 1;
+}
+
+void editorCopyAll(){
+    size_t len;
+    char *buf = editorRowsToString(&len);
+    killRingPush(buf, len, 0);
+    editorSetStatusMessage("Copied to Clipboard Successfully: %zu", len);
+    free(buf);
+}
+
+// cut the row at the cursor, rows cut one after another paste back together
+void editorCutRow(){
+    if (E.cy >= E.numrows) return;
+    erow *row = editorRowAt(E.cy);
+    char *text = malloc(row->size + 1);
+    if (text == NULL) die("editorCutRow: out of memory");
+    memcpy(text, row->chars, row->size);
+    text[row->size] = '\n';
+    killRingPush(text, row->size + 1, K.append);
+    editorSetStatusMessage("Row Cut to Clipboard: %d | ^V: paste", row->size);
+    free(text);
+    editorDelRow(E.cy);
+    E.cx = 0;
+    K.append = 1;
+}
+
+// paste the newest kill ring entry, ^V right after a paste swaps it for the one before
+void editorYank(){
+    if (K.n == 0){
+        editorSetStatusMessage("Nothing to paste");
+        return;
+    }
+    int entry = K.head;
+    if (K.yank >= 0 && U.top == K.yanktop && U.top >= 0){
+        editorUndo();
+        entry = (K.yank - 1 + CPEDI_KILL_RING) % CPEDI_KILL_RING;
+        if ((K.head - entry + CPEDI_KILL_RING) % CPEDI_KILL_RING >= K.n) entry = K.head;
+    }
+    // the paste is its own undo step so it can be swapped
+    undoBreak();
+    editorInsertText(K.ring[entry], K.ringlen[entry]);
+    undoBreak();
+    K.yank = entry;
+    K.yanktop = U.top;
+    if (K.n > 1){
+        editorSetStatusMessage("Pasted entry %d of %d | ^V again: older",
+            (K.head - entry + CPEDI_KILL_RING) % CPEDI_KILL_RING + 1, K.n);
+    }
+}
+
+/* File i/o */
+
+char* editorRowsToString(size_t *buflen){
+    editorLoadAllRows();
+    size_t totlen = 0;
+    int j;
+    for (j = 0; j < E.numrows; j++){
+        totlen += editorRowAt(j)->size + 1;
+    }
+    *buflen = totlen;
+
+    char *buf = malloc(totlen+1);
+    char *p = buf; // pointer to navigate buf string
+    for (j = 0; j < E.numrows; j++){
+        erow *row = editorRowAt(j);
+        memcpy(p, row->chars, row->size);
+        p += row->size;
+        *p = '\n';
+        p++;
+    }
+    return buf;
+}
+
+// map the file and only build rows for what is on screen, lines are turned
+// into rows as the viewport reaches them
+int editorMapFile(char *filename){
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0){
+        close(fd);
+        return -1;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (map == MAP_FAILED) return -1;
+
+    E.map = map;
+    E.maplen = st.st_size;
+    E.mapoff = 0;
+    E.mapline = 0;
+    // line starts are collected in the background for teleport and the line count
+    E.index = lineIndexStart(map, E.maplen);
+    E.indexseen = 0;
+    editorLoadRowsUntil(E.screenrows);
+    return 0;
+}
+
+void editorOpen(char *filename){
+    free(E.filename);
+    E.filename = strdup(filename); // duplicate the string
+    editorSelectSyntax();
+    size_t allocs = E.arena.allocs;
+    // the file as it was opened is where undo stops
+    undoClear();
+    U.mute++;
+
+    if (editorMapFile(filename) == 0){
+        E.dirty = 0;
+        editorOpenTemplate();
+        E.openallocs = E.arena.allocs - allocs;
+        U.mute--;
+        return;
+    }
+
+    FILE *fp = fopen(filename, "r");
+    if (!fp) die("editorOpen: Error while opening file");
+   
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen = 0;
+    while ((linelen = getline(&line, &linecap, fp))!=-1){
+        while (linelen > 0 && (line[linelen-1] == '\r' || line[linelen-1] == '\n'))
+        {
+            linelen--;
+        }
+        editorInsertRow(E.numrows, line, linelen);
+    }   
+    free(line);
+    fclose(fp);
+    E.dirty = 0;
+    editorOpenTemplate();
+    E.openallocs = E.arena.allocs - allocs;
+    U.mute--;
+}
+
+void editorOpenTemplate(){
+    if (strcmp(E.filename,"cp/template.cpp")==0){
+        E.cy = 45;
+        editorScroll();
+        E.cy = 30;
+        E.cx = 0;   
+        editorInsertChar('\t');
+    }
+}
+
+// writev() every iovec, picking up after partial writes
+int writeAllv(int fd, struct iovec *iov, int cnt){
+    while (cnt > 0){
+        ssize_t n = writev(fd, iov, cnt);
+        if (n == -1){
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len){
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0){
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// keep chars the save thread may still read until the save is done
+void editorBury(char *chars, int cap){
+    if (E.ngrave == E.gravecap){
+        E.gravecap = imax(16, E.gravecap*2);
+        E.graveyard = realloc(E.graveyard, sizeof(struct rowBlock)*E.gravecap);
+        if (E.graveyard == NULL) die("editorBury: out of memory");
+    }
+    E.graveyard[E.ngrave].p = chars;
+    E.graveyard[E.ngrave++].cap = cap;
+}
+
+// stream the snapshot to fd straight from the rows' chars, no copy of the buffer
+int saveWriteLines(int fd, struct saveJob *job){
+    static char newline = '\n';
+    struct iovec iov[CPEDI_IOV_BATCH];
+    struct timespec last, now;
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    size_t written = 0;
+    int cnt = 0, j;
+    for (j = 0; j < job->nlines; j++){
+        if (job->lines[j].len > 0){
+            iov[cnt].iov_base = (char *)job->lines[j].chars;
+            iov[cnt++].iov_len = job->lines[j].len;
+        }
+        iov[cnt].iov_base = &newline;
+        iov[cnt++].iov_len = 1;
+        written += job->lines[j].len + 1;
+        if (cnt >= CPEDI_IOV_BATCH-1){
+            if (writeAllv(fd, iov, cnt) == -1) return -1;
+            cnt = 0;
+            atomic_store(&job->written, written);
+            // let the status bar show progress every now and then
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec-last.tv_sec)*1000 + (now.tv_nsec-last.tv_nsec)/1000000 >= CPEDI_READ_WAIT_TIME){
+                last = now;
+                editorWake();
+            }
+        }
+    }
+    if (writeAllv(fd, iov, cnt) == -1) return -1;
+    atomic_store(&job->written, written);
+    size_t off, len;
+    for (off = 0; off < job->taillen; off += len){
+        len = job->taillen - off < CPEDI_SAVE_CHUNK ? job->taillen - off : CPEDI_SAVE_CHUNK;
+        struct iovec span = {(char *)job->tail + off, len};
+        if (writeAllv(fd, &span, 1) == -1) return -1;
+        atomic_store(&job->written, written + off + len);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec-last.tv_sec)*1000 + (now.tv_nsec-last.tv_nsec)/1000000 >= CPEDI_READ_WAIT_TIME){
+            last = now;
+            editorWake();
+        }
+    }
+    return 0;
+}
+
+// The snapshot goes to a temporary file next to the target which is synced and
+// then renamed over it, so a crash leaves either the old or the new file.
+void *saveThread(void *arg){
+    struct saveJob *job = arg;
+    size_t tlen = strlen(job->target);
+    char *tmp = malloc(tlen + 16);
+    snprintf(tmp, tlen + 16, "%s.cpedi-XXXXXX", job->target);
+
+    job->err = 0;
+    int fd = mkstemp(tmp);
+    if (fd != -1){
+        int renamed = 0;
+        if (fchmod(fd, job->mode) != -1 && saveWriteLines(fd, job) != -1
+            && fsync(fd) != -1 && close(fd) != -1){
+            fd = -1;
+            renamed = rename(tmp, job->target) != -1;
+        }
+        if (renamed){
+            // make the rename itself durable
+            char *slash = strrchr(job->target, '/');
+            if (slash) *slash = '\0';
+            int dfd = open(slash ? (slash == job->target ? "/" : job->target) : ".", O_RDONLY);
+            if (slash) *slash = '/';
+            if (dfd != -1){
+                fsync(dfd);
+                close(dfd);
+            }
+        } else {
+            job->err = errno;
+            if (fd != -1) close(fd);
+            unlink(tmp);
+        }
+    } else {
+        job->err = errno;
+    }
+    free(tmp);
+    atomic_store(&job->done, 1);
+    editorWake();
+    return NULL;
+}
+
+// report a finished save and drop the snapshot
+void editorSaveFinish(){
+    struct saveJob *job = E.save;
+    if (job->threaded) pthread_join(job->thread, NULL);
+    if (job->err == 0){
+        // edits made while saving are still unsaved
+        if (E.dirty == job->dirty) E.dirty = 0;
+        editorSetStatusMessage("%zu File Saved Successfully!", job->total);
+    } else {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(job->err));
+    }
+    int j;
+    for (j = 0; j < E.ngrave; j++) arenaFree(&E.arena, E.graveyard[j].p, E.graveyard[j].cap);
+    E.ngrave = 0;
+    free(job->lines);
+    free(job->target);
+    free(job);
+    E.save = NULL;
+}
+
+// pick up the result of a background save once it is written
+void editorCheckSave(){
+    if (E.save && atomic_load(&E.save->done)) editorSaveFinish();
+}
+
+// The rows are written by a background thread so editing goes on while a
+// big file is saved. It gets a snapshot of every row's chars, rows changed
+// afterwards copy their chars first (see editorRowReserve()) and the old
+// buffers are freed when the save is done. Rows borrowing from a mapped
+// file stay valid, the mapping keeps the old file, and the lines that are
+// not rows yet are written straight from it as one span.
+void editorSave(int newFile){
+    if (E.save){
+        editorSetStatusMessage("Still saving, try again once it is done");
+        return;
+    }
+    if (E.filename == NULL || newFile) {
+        char *name = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if (name == NULL){
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        free(E.filename);
+        E.filename = name;
+        editorSelectSyntax();
+        screenMarkAllDirty();
+    }
+
+    struct saveJob *job = calloc(1, sizeof(struct saveJob));
+    if (job == NULL) die("editorSave: out of memory");
+    job->lines = malloc(sizeof(struct saveLine)*imax(E.numrows, 1));
+    if (job->lines == NULL) die("editorSave: out of memory");
+    int j;
+    for (j = 0; j < E.numrows; j++){
+        erow *row = editorRowAt(j);
+        job->lines[j].chars = row->chars;
+        job->lines[j].len = row->size;
+        job->total += row->size + 1;
+        if (row->cap) row->shared = 1;
+    }
+    job->nlines = E.numrows;
+    if (!editorFullyLoaded()){
+        job->tail = &E.map[E.mapoff];
+        job->taillen = E.maplen - E.mapoff;
+        job->total += job->taillen;
+    }
+    job->dirty = E.dirty;
+
+    // save through symlinks instead of replacing them
+    job->target = realpath(E.filename, NULL);
+    if (job->target == NULL) job->target = strdup(E.filename);
+    // keep the permissions of the file being replaced
+    // 0644 => Standard permission for textfiles (Owner gets rw other get r)
+    struct stat st;
+    if (stat(job->target, &st) == 0){
+        job->mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        job->mode = 0644 & ~mask;
+    }
+
+    E.save = job;
+    if (pthread_create(&job->thread, NULL, saveThread, job) == 0){
+        job->threaded = 1;
+        editorSetStatusMessage("Saving...");
+    } else {
+        saveThread(job);
+        editorSaveFinish();
+    }
+}
+
+// drop the file and all of its rows, the row buffers go back with their slabs
+void editorCloseBuffer(){
+    if (E.save) editorSaveFinish();
+    lineIndexFree(E.index);
+    E.index = NULL;
+    if (E.map) munmap(E.map, E.maplen);
+    E.map = NULL;
+    E.maplen = E.mapoff = E.mapline = 0;
+    arenaRelease(&E.arena);
+    free(E.row);
+    E.row = NULL;
+    E.rowcap = E.rowgap = E.numrows = 0;
+    free(E.filename);
+    E.filename = NULL;
+    free(B.node);
+    B.node = NULL;
+    B.size = 0;
+    undoClear();
+    compileStop();
+    editorSelectSyntax();
+    E.cy = E.rowoff = E.coloff = 0;
+    E.cx = E.rx = 0;
+    E.dirty = 0;
+    screenMarkAllDirty();
+}
+
+/* Message Pane */
+
+// open (rows taken from the bottom of the text) or close the pane
+void editorPaneShow(int open){
+    int total = E.screenrows + P.rows;
+    int rows = open ? imin(CPEDI_PANE_ROWS, total/3) : 0;
+    if (rows == P.rows) return;
+    P.rows = rows;
+    E.screenrows = total - rows;
+    screenMarkAllDirty();
+}
+
+void paneClear(){
+    int j;
+    for (j = 0; j < P.n; j++) free(P.lines[j]);
+    P.n = 0;
+    P.top = 0;
+    P.follow = 1;
+    P.mark = -1;
+}
+
+void paneAppend(const char *s, size_t len, unsigned char attr){
+    if (P.n == CPEDI_PANE_LINES) return;
+    if (P.n == P.cap){
+        P.cap = imax(64, P.cap*2);
+        P.lines = realloc(P.lines, sizeof(char *)*P.cap);
+        P.attrs = realloc(P.attrs, P.cap);
+        if (P.lines == NULL || P.attrs == NULL) die("paneAppend: out of memory");
+    }
+    char *line = malloc(len+1);
+    if (line == NULL) die("paneAppend: out of memory");
+    memcpy(line, s, len);
+    line[len] = '\0';
+    P.lines[P.n] = line;
+    P.attrs[P.n++] = attr;
+    if (P.follow) P.top = imax(0, P.n - P.rows);
+}
+
+// replace the text of line
+void paneSet(int line, const char *s, unsigned char attr){
+    if (line < 0 || line >= P.n) return;
+    free(P.lines[line]);
+    P.lines[line] = strdup(s);
+    if (P.lines[line] == NULL) die("paneSet: out of memory");
+    P.attrs[line] = attr;
+}
+
+/* Compile */
+
+// Ctrl-E hands the buffer to the compiler on its stdin, without saving, and
+// editing goes on while it runs. Its output streams into the message pane
+// and ^G walks the errors. Binaries are cached under the hash of the source
+// and the command, so compiling an unchanged buffer again costs nothing.
+
+// 64-bit FNV-1a, h is the hash so far
+static uint64_t hashBytes(uint64_t h, const char *s, size_t len){
+    size_t j;
+    for (j = 0; j < len; j++){
+        h ^= (unsigned char)s[j];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// directory the binaries are cached in, created on first use
+static char *compileCacheDir(){
+    static char dir[PATH_MAX];
+    if (dir[0]) return dir;
+    char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    if (xdg && *xdg) snprintf(dir, sizeof(dir), "%s/cpedi", xdg);
+    else if (home && *home) snprintf(dir, sizeof(dir), "%s/.cache/cpedi", home);
+    else snprintf(dir, sizeof(dir), "/tmp/cpedi-%d", (int)getuid());
+    // every missing directory on the way
+    char *p;
+    for (p = dir+1; *p; p++){
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(dir, 0755);
+        *p = '/';
+    }
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) dir[0] = '\0';
+    return dir;
+}
+
+struct cacheEntry
+{
+    time_t used; // mtime, touched again on every cache hit
+    char name[32];
+};
+
+static int cacheNewerFirst(const void *a, const void *b){
+    time_t x = ((const struct cacheEntry *)a)->used, y = ((const struct cacheEntry *)b)->used;
+    return (x < y) - (x > y);
+}
+
+// Once at startup: the temp files of compiles whose editor is gone are
+// removed, and so are all but the CPEDI_CACHE_KEEP binaries used last.
+void compileCacheSweep(){
+    char *dir = compileCacheDir();
+    DIR *d = dir[0] ? opendir(dir) : NULL;
+    if (d == NULL) return;
+    struct cacheEntry *bins = NULL;
+    int n = 0, cap = 0, j;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL){
+        size_t len = strlen(ent->d_name);
+        int pid;
+        if (len > 4 && strcmp(ent->d_name + len - 4, ".tmp") == 0){
+            // <hash>.<pid>.<thread>.tmp, see compileJobNew
+            if (sscanf(ent->d_name, "%*16[0-9a-f].%d.", &pid) == 1 && kill(pid, 0) == -1 && errno == ESRCH){
+                unlinkat(dirfd(d), ent->d_name, 0);
+            }
+            continue;
+        }
+        struct stat st;
+        if (len != 16 || fstatat(dirfd(d), ent->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode)) continue;
+        if (n == cap){
+            cap = imax(64, cap*2);
+            bins = realloc(bins, sizeof(struct cacheEntry)*cap);
+            if (bins == NULL) die("compileCacheSweep: out of memory");
+        }
+        bins[n].used = st.st_mtime;
+        memcpy(bins[n++].name, ent->d_name, len+1);
+    }
+    if (n > CPEDI_CACHE_KEEP){
+        qsort(bins, n, sizeof(struct cacheEntry), cacheNewerFirst);
+        for (j = CPEDI_CACHE_KEEP; j < n; j++) unlinkat(dirfd(d), bins[j].name, 0);
+    }
+    free(bins);
+    closedir(d);
+}
+
+// the buffer's binary is now target. The one it had before is removed from
+// the cache unless a stress run is still using it
+static void compileSetBinary(const char *target){
+    if (M.binary && strcmp(M.binary, target) != 0 && !(X.running && X.binary && strcmp(X.binary, M.binary) == 0)){
+        unlink(M.binary);
+    }
+    free(M.binary);
+    M.binary = strdup(target);
+}
+
+// append len bytes to what the compiler printed, the main thread picks them up
+static void compileOutput(struct compileJob *job, const char *s, size_t len){
+    pthread_mutex_lock(&job->lock);
+    if (job->outlen + len > job->outcap){
+        job->outcap = imax(job->outlen + len, job->outcap*2);
+        job->out = realloc(job->out, job->outcap);
+        if (job->out == NULL) die("compileOutput: out of memory");
+    }
+    memcpy(&job->out[job->outlen], s, len);
+    job->outlen += len;
+    pthread_mutex_unlock(&job->lock);
+    editorWake();
+}
+
+// spawns the compiler, feeds it the source and collects what it prints
+void *compileThread(void *arg){
+    struct compileJob *job = arg;
+    int in[2], out[2];
+    job->ok = 0;
+    if (pipe2(in, O_CLOEXEC) == -1) goto done;
+    if (pipe2(out, O_CLOEXEC) == -1){
+        close(in[0]);
+        close(in[1]);
+        goto done;
+    }
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_adddup2(&fa, in[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, out[1], STDERR_FILENO);
+    pid_t pid;
+    int err = posix_spawnp(&pid, job->argv[0], &fa, NULL, job->argv, environ);
+    posix_spawn_file_actions_destroy(&fa);
+    close(in[0]);
+    close(out[1]);
+    if (err == 0){
+        atomic_store(&job->pid, pid);
+        if (atomic_load(&job->cancel)) kill(pid, SIGTERM);
+    }
+    if (err != 0){
+        char msg[128];
+        int n = snprintf(msg, sizeof(msg), "cannot run %s: %s\n", job->argv[0], strerror(err));
+        compileOutput(job, msg, n);
+        close(in[1]);
+        close(out[0]);
+        goto done;
+    }
+
+    // the source goes in while the output comes out, neither side can stall the other
+    fcntl(in[1], F_SETFL, O_NONBLOCK);
+    size_t off = 0;
+    int infd = in[1];
+    char buf[4096];
+    while (1){
+        if (infd != -1 && off == job->len){
+            close(infd);
+            infd = -1;
+        }
+        struct pollfd pfd[2] = {{out[0], POLLIN, 0}, {infd, POLLOUT, 0}};
+        if (poll(pfd, 2, -1) == -1){
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (infd != -1 && (pfd[1].revents & (POLLOUT | POLLERR | POLLHUP))){
+            ssize_t n = write(infd, &job->source[off], job->len - off);
+            if (n > 0) off += n;
+            else if (n == -1 && errno != EAGAIN && errno != EINTR) off = job->len; // it stopped reading
+        }
+        if (pfd[0].revents & (POLLIN | POLLHUP)){
+            ssize_t n = read(out[0], buf, sizeof(buf));
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) break;
+            compileOutput(job, buf, n);
+        }
+    }
+    if (infd != -1) close(infd);
+    close(out[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    job->ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && rename(job->tmp, job->target) == 0;
+done:
+    if (!job->ok) unlink(job->tmp);
+    atomic_store(&job->done, 1);
+    editorWake();
+    return NULL;
+}
+
+static void compileFreeJob(struct compileJob *job){
+    int j;
+    for (j = 0; job->argv[j]; j++) free(job->argv[j]);
+    free(job->argv);
+    free(job->source);
+    free(job->target);
+    free(job->tmp);
+    free(job->out);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+// a line of compiler output goes to the pane, lines about the buffer are
+// remembered for ^G and name the file instead of <stdin>
+static void compileLine(char *line, size_t len){
+    static const char stdinName[] = "<stdin>:";
+    int n = sizeof(stdinName)-1;
+    unsigned char attr = ATTR_NORMAL;
+    if (len > (size_t)n && memcmp(line, stdinName, n) == 0){
+        int l = 0, c = 0, used = 0;
+        if (sscanf(line + n, "%d:%d: %n", &l, &c, &used) == 2 && used > 0){
+            char *kind = line + n + used;
+            int error = strncmp(kind, "error", 5) == 0 || strncmp(kind, "fatal error", 11) == 0;
+            if (error || strncmp(kind, "warning", 7) == 0){
+                if (M.ndiags == M.diagcap){
+                    M.diagcap = imax(16, M.diagcap*2);
+                    M.diags = realloc(M.diags, sizeof(struct diagnostic)*M.diagcap);
+                    if (M.diags == NULL) die("compileLine: out of memory");
+                }
+                // paneAppend drops lines past CPEDI_PANE_LINES
+                M.diags[M.ndiags++] = (struct diagnostic){l, c, P.n < CPEDI_PANE_LINES ? P.n : -1};
+                M.errors += error;
+                if (error) attr = ATTR_ERROR;
+            }
+        }
+        const char *name = E.filename ? E.filename : "[No Name]";
+        int namelen = strlen(name);
+        char *named = malloc(namelen + 1 + len - n);
+        if (named == NULL) die("compileLine: out of memory");
+        memcpy(named, name, namelen);
+        named[namelen] = ':';
+        memcpy(named + namelen + 1, line + n, len - n);
+        paneAppend(named, namelen + 1 + len - n, attr);
+        free(named);
+        return;
+    }
+    paneAppend(line, len, attr);
+}
+
+// keep the start of a line until the rest of it arrives
+static void compilePartial(const char *s, size_t len){
+    if (len == 0) return;
+    M.partial = realloc(M.partial, M.partlen + len);
+    if (M.partial == NULL) die("compilePartial: out of memory");
+    memcpy(&M.partial[M.partlen], s, len);
+    M.partlen += len;
+}
+
+// move what the compiler printed into the pane, and finish the compile once it exited
+void editorCheckCompile(){
+    struct compileJob *job = M.job;
+    if (job == NULL) return;
+    int done = atomic_load(&job->done);
+    pthread_mutex_lock(&job->lock);
+    size_t len = job->outlen - M.seen;
+    char *chunk = malloc(len+1);
+    if (chunk == NULL) die("editorCheckCompile: out of memory");
+    if (len) memcpy(chunk, &job->out[M.seen], len);
+    M.seen = job->outlen;
+    pthread_mutex_unlock(&job->lock);
+
+    size_t j, from = 0;
+    for (j = 0; j < len; j++){
+        if (chunk[j] != '\n') continue;
+        if (M.partlen){
+            // the start of this line came with an earlier chunk
+            compilePartial(&chunk[from], j - from);
+            compileLine(M.partial, M.partlen);
+            M.partlen = 0;
+        } else {
+            compileLine(&chunk[from], j - from);
+        }
+        from = j+1;
+    }
+    compilePartial(&chunk[from], len - from);
+    free(chunk);
+    if (!done) return;
+
+    pthread_join(job->thread, NULL);
+    if (M.partlen) compileLine(M.partial, M.partlen);
+    M.partlen = 0;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - M.start.tv_sec) + (end.tv_nsec - M.start.tv_nsec)/1e9;
+    int warnings = M.ndiags - M.errors;
+    if (job->ok){
+        compileSetBinary(job->target);
+        editorSetStatusMessage("Compiled in %.1fs, %d warnings | ^G: next", secs, warnings);
+        if (P.n == 0) editorPaneShow(0);
+        if (M.then) M.then();
+    } else {
+        editorSetStatusMessage("Compile failed in %.1fs: %d errors, %d warnings | ^G: next, ESC: hide",
+            secs, M.errors, warnings);
+    }
+    M.job = NULL;
+    M.then = NULL;
+    compileFreeJob(job);
+}
+
+// kill a running compile and forget its diagnostics, the buffer they were about is gone
+void compileStop(){
+    struct compileJob *job = M.job;
+    if (job){
+        atomic_store(&job->cancel, 1);
+        int pid = atomic_load(&job->pid);
+        if (pid > 0) kill(pid, SIGTERM);
+        pthread_join(job->thread, NULL);
+        compileFreeJob(job);
+        M.job = NULL;
+    }
+    M.ndiags = M.errors = M.next = 0;
+    M.partlen = 0;
+    M.then = NULL;
+    free(M.binary);
+    M.binary = NULL;
+    testsStop();
+    stressStop();
+    paneClear();
+    editorPaneShow(0);
+}
+
+// argv of the compiler for a source file, without the output file
+static char **compileCommand(const char *filename, int *argc){
+    int c = filename && strlen(filename) > 2 && strcmp(filename + strlen(filename) - 2, ".c") == 0;
+    char *flags = strdup(c ? CPEDI_CFLAGS : CPEDI_CXXFLAGS);
+    char **argv = malloc(sizeof(char *)*(strlen(flags)/2 + 10));
+    if (flags == NULL || argv == NULL) die("compileCommand: out of memory");
+    int n = 0;
+    argv[n++] = strdup(c ? CPEDI_CC : CPEDI_CXX);
+    argv[n++] = strdup("-x");
+    argv[n++] = strdup(c ? "c" : "c++");
+    // quoted includes are looked up next to the file
+    char *dir = strdup(filename ? filename : ".");
+    char *slash = strrchr(dir, '/');
+    if (slash) *slash = '\0';
+    argv[n] = malloc(strlen(dir) + 3);
+    sprintf(argv[n++], "-I%s", slash ? dir : ".");
+    free(dir);
+    char *save, *flag;
+    for (flag = strtok_r(flags, " ", &save); flag; flag = strtok_r(NULL, " ", &save)){
+        argv[n++] = strdup(flag);
+    }
+    free(flags);
+    argv[n] = NULL;
+    *argc = n;
+    return argv;
+}
+
+// where the binary of this source and command is cached
+static uint64_t compileTarget(char **argv, int argc, const char *source, size_t len, char *target, size_t size){
+    uint64_t h = 14695981039346656037ULL;
+    int j;
+    for (j = 0; j < argc; j++) h = hashBytes(h, argv[j], strlen(argv[j]) + 1);
+    h = hashBytes(h, source, len);
+    if (snprintf(target, size, "%s/%016llx", compileCacheDir(), (unsigned long long)h) >= (int)size){
+        die("compileTarget: cache directory path too long");
+    }
+    return h;
+}
+
+// a compile of source into target, which takes over argv and source
+static struct compileJob *compileJobNew(char **argv, int argc, char *source, size_t len, const char *target){
+    struct compileJob *job = calloc(1, sizeof(struct compileJob));
+    if (job == NULL) die("compileJobNew: out of memory");
+    // -o tmp - => the binary goes to tmp, the source comes from stdin
+    argv = realloc(argv, sizeof(char *)*(argc + 4));
+    if (argv == NULL) die("compileJobNew: out of memory");
+    job->target = strdup(target);
+    job->tmp = malloc(strlen(target) + 48);
+    // the thread id keeps stress builds of the same file apart
+    sprintf(job->tmp, "%s.%d.%lx.tmp", target, (int)getpid(), (unsigned long)pthread_self());
+    argv[argc++] = strdup("-o");
+    argv[argc++] = strdup(job->tmp);
+    argv[argc++] = strdup("-");
+    argv[argc] = NULL;
+    job->argv = argv;
+    job->source = source;
+    job->len = len;
+    pthread_mutex_init(&job->lock, NULL);
+    atomic_init(&job->done, 0);
+    return job;
+}
+
+// 2 if the build is up to date, 1 if a compile started, 0 if it could not
+int editorCompile(){
+    if (M.job){
+        editorSetStatusMessage("Still compiling, ^E again once it is done");
+        return 0;
+    }
+    if (R.running){
+        // line j of the pane is test j until they are all done
+        editorSetStatusMessage("Tests are still running");
+        return 0;
+    }
+    if (!compileCacheDir()[0]){
+        editorSetStatusMessage("No directory to keep builds in");
+        return 0;
+    }
+    size_t len;
+    char *source = editorRowsToString(&len);
+    int argc, j;
+    char **argv = compileCommand(E.filename, &argc);
+    char target[PATH_MAX];
+    uint64_t h = compileTarget(argv, argc, source, len, target, sizeof(target));
+    M.ndiags = M.errors = M.next = 0;
+    M.partlen = 0;
+    M.hash = h;
+    clock_gettime(CLOCK_MONOTONIC, &M.start);
+    if (access(target, X_OK) == 0){
+        // same source, same command: the binary is already there
+        for (j = 0; j < argc; j++) free(argv[j]);
+        free(argv);
+        free(source);
+        utimensat(AT_FDCWD, target, NULL, 0); // used now, for compileCacheSweep
+        compileSetBinary(target);
+        paneClear();
+        editorPaneShow(0);
+        editorSetStatusMessage("Build is up to date: %s", target);
+        return 2;
+    }
+
+    struct compileJob *job = compileJobNew(argv, argc, source, len, target);
+    if (pthread_create(&job->thread, NULL, compileThread, job) != 0){
+        compileFreeJob(job);
+        editorSetStatusMessage("Cannot start the compile");
+        return 0;
+    }
+    M.job = job;
+    M.seen = 0;
+    paneClear();
+    editorPaneShow(1);
+    editorSetStatusMessage("Compiling...");
+    return 1;
+}
+
+// move to the next line the compiler complained about
+void editorNextDiagnostic(){
+    if (M.ndiags == 0){
+        editorSetStatusMessage(M.job ? "No errors yet" : "No errors to go to");
+        return;
+    }
+    struct diagnostic *d = &M.diags[M.next % M.ndiags];
+    int k = M.next % M.ndiags;
+    M.next = k + 1;
+    if (editorTeleportTo(d->line)) E.cx = imin(imax(d->col-1, 0), getRowLength());
+    editorPaneShow(1);
+    P.follow = 0;
+    P.mark = d->pane;
+    if (d->pane != -1) P.top = imax(0, imin(d->pane, P.n - P.rows));
+    editorSetStatusMessage("Diagnostic %d of %d", k+1, M.ndiags);
+}
+
+/* Sample Tests */
+
+// Ctrl-T builds the buffer and runs it on every *.in next to the file, on
+// as many threads as there are cores. Each run gets cpu time and address
+// space limits, and wait4() reports its cpu time and peak memory. The
+// output is compared with the matching *.out while it is being produced,
+// ignoring how the tokens are spaced. Results fill the message pane as
+// the tests finish.
+
+// reads a file or a pipe with every run of whitespace turned into a single
+// space and none at either end, a pipe is given up on at the deadline
+struct normReader
+{
+    int fd;
+    double deadline; // monotonic seconds, 0 for a file
+    char buf[4096];
+    int pos, len;
+    int started, pending, stash;
+};
+
+#define NORM_EOF -1
+#define NORM_TIMEOUT -2
+
+static double monotonicSeconds(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec/1e9;
+}
+
+static int normRaw(struct normReader *r){
+    while (r->pos == r->len){
+        if (r->deadline > 0){
+            int ms = (int)((r->deadline - monotonicSeconds())*1000);
+            struct pollfd pfd = {r->fd, POLLIN, 0};
+            if (ms <= 0 || poll(&pfd, 1, ms) == 0) return NORM_TIMEOUT;
+        }
+        ssize_t n = read(r->fd, r->buf, sizeof(r->buf));
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return NORM_EOF;
+        r->pos = 0;
+        r->len = n;
+    }
+    return (unsigned char)r->buf[r->pos++];
+}
+
+static int normGet(struct normReader *r){
+    if (r->stash >= 0){
+        int c = r->stash;
+        r->stash = -1;
+        return c;
+    }
+    while (1){
+        int c = normRaw(r);
+        if (c < 0) return c;
+        if (isspace(c)){
+            r->pending = r->started;
+            continue;
+        }
+        r->started = 1;
+        if (r->pending){
+            r->pending = 0;
+            r->stash = c;
+            return ' ';
+        }
+        return c;
+    }
+}
+
+// start argv[0] reading in and writing out, under the limits of a test.
+// vfork does not copy the editor's address space the way fork does, and
+// the child sets its limits before exec so they hold from the first
+// instruction. Returns -1 if it could not be started
+static pid_t spawnLimited(char *const argv[], int in, int out){
+    struct rlimit cpu = {CPEDI_TEST_TIME + 1, CPEDI_TEST_TIME + 2};
+    // twice the limit, so going over it shows up as peak memory instead of a crash
+    struct rlimit mem = {(rlim_t)CPEDI_TEST_MEMORY << 21, (rlim_t)CPEDI_TEST_MEMORY << 21};
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (devnull == -1) return -1;
+    // the child shares our memory until exec, this is how it reports a failed exec
+    volatile int failed = 0;
+    pid_t pid = vfork();
+    if (pid == 0){
+        // only system calls until exec, the parent is borrowed
+        if (setrlimit(RLIMIT_CPU, &cpu) == -1 || setrlimit(RLIMIT_AS, &mem) == -1 ||
+            dup2(in, STDIN_FILENO) == -1 || dup2(out, STDOUT_FILENO) == -1 ||
+            dup2(devnull, STDERR_FILENO) == -1){
+            failed = 1;
+            _exit(127);
+        }
+        execve(argv[0], argv, environ);
+        failed = 1;
+        _exit(127);
+    }
+    close(devnull);
+    if (pid != -1 && failed){
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+        return -1;
+    }
+    return pid;
+}
+
+// reap pid, killing it at the deadline. 1 if it had to be killed, -1 if
+// it could not be reaped and status and ru say nothing
+static int waitLimited(pid_t pid, double deadline, int *status, struct rusage *ru){
+    int killed = 0, fd = -1;
+    pid_t r;
+#if defined(SYS_pidfd_open)
+    fd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+    if (fd != -1){
+        // a pidfd turns readable when the process exits
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int n, ms;
+        do {
+            ms = (int)((deadline - monotonicSeconds())*1000);
+            n = ms > 0 ? poll(&pfd, 1, ms) : 0;
+        } while (n == -1 && errno == EINTR);
+        close(fd);
+        if (n <= 0){
+            kill(pid, SIGKILL);
+            killed = 1;
+        }
+    } else {
+        // no pidfds: check back in naps, short at first since most runs are over in a few ms
+        long nap = 20000;
+        while ((r = wait4(pid, status, WNOHANG, ru)) == 0 && monotonicSeconds() < deadline){
+            struct timespec t = {0, nap};
+            nanosleep(&t, NULL);
+            nap = nap < 1000000 ? nap*2 : nap;
+        }
+        if (r == pid) return 0;
+        if (r == -1 && errno != EINTR) return -1;
+        kill(pid, SIGKILL);
+        killed = 1;
+    }
+    while ((r = wait4(pid, status, 0, ru)) == -1 && errno == EINTR);
+    return r == pid ? killed : -1;
+}
+
+// output of a program against what it should be, while it is still
+// writing: TEST_AC, TEST_WA at the first wrong token, or TEST_TLE
+static int testCompareOutput(int out, double deadline, int expect){
+    struct normReader got = {out, deadline, "", 0, 0, 0, 0, -1};
+    struct normReader want = {expect, 0, "", 0, 0, 0, 0, -1};
+    int verdict = TEST_AC, a, b;
+    do {
+        a = normGet(&got);
+        b = expect != -1 ? normGet(&want) : a;
+        if (a == NORM_TIMEOUT) verdict = TEST_TLE;
+        else if (a != b) verdict = TEST_WA;
+    } while (a >= 0 && verdict == TEST_AC);
+    return verdict;
+}
+
+// run the binary on in and compare with expect, -1 if there is nothing to
+// compare with. Fills in the verdict and measurements of t
+static void testRunOn(struct sampleTest *t, const char *binary, int in, int expect){
+    double limit = CPEDI_TEST_TIME;
+    int out[2];
+    if (pipe2(out, O_CLOEXEC) == -1){
+        t->verdict = TEST_FAIL;
+        return;
+    }
+    double start = monotonicSeconds();
+    char *argv[] = {(char *)binary, NULL};
+    pid_t pid = spawnLimited(argv, in, out[1]);
+    close(out[1]);
+    if (pid == -1){
+        t->verdict = TEST_FAIL;
+        close(out[0]);
+        return;
+    }
+    atomic_store(&t->pid, pid);
+
+    // a wrong token ends the run
+    double deadline = start + 2*limit + 1;
+    int verdict = testCompareOutput(out[0], deadline, expect);
+    close(out[0]);
+    if (verdict != TEST_AC) kill(pid, SIGKILL);
+
+    // a program can close its output and keep going, the wall limit still holds
+    int status;
+    struct rusage ru;
+    int waited = waitLimited(pid, deadline, &status, &ru);
+    atomic_store(&t->pid, 0);
+    if (waited == -1){
+        t->verdict = TEST_FAIL;
+        return;
+    }
+    if (waited) verdict = TEST_TLE;
+    t->wall = monotonicSeconds() - start;
+    t->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+    t->rss = ru.ru_maxrss;
+    if (t->cpu > limit || (WIFSIGNALED(status) && WTERMSIG(status) == SIGXCPU)) verdict = TEST_TLE;
+    else if (verdict == TEST_TLE || verdict == TEST_WA) ; // killed by us
+    else if (t->rss >= (long)CPEDI_TEST_MEMORY << 10) verdict = TEST_MLE;
+    else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) verdict = TEST_RE;
+    else if (expect == -1) verdict = TEST_RAN;
+    t->verdict = verdict;
+}
+
+// run the binary on one test
+static void testRun(struct sampleTest *t, const char *binary){
+    int in = open(t->in, O_RDONLY | O_CLOEXEC);
+    int expect = t->out ? open(t->out, O_RDONLY | O_CLOEXEC) : -1;
+    if (in == -1) t->verdict = TEST_FAIL;
+    else testRunOn(t, binary, in, expect);
+    if (in != -1) close(in);
+    if (expect != -1) close(expect);
+}
+
+void *testThread(void *arg){
+    (void)arg;
+    while (!atomic_load(&R.cancel)){
+        int k = atomic_fetch_add(&R.next, 1);
+        if (k >= R.ntests) break;
+        testRun(&R.tests[k], R.binary);
+        atomic_store(&R.tests[k].done, 1);
+        editorWake();
+    }
+    return NULL;
+}
+
+static int testCompare(const void *a, const void *b){
+    return strverscmp(((const struct sampleTest *)a)->name, ((const struct sampleTest *)b)->name);
+}
+
+// the directory of the buffer's file and its name without the extension
+static void splitFilename(char **dir, char **stem){
+    const char *name = E.filename ? E.filename : "./x";
+    const char *slash = strrchr(name, '/');
+    const char *base = slash ? slash+1 : name;
+    const char *dot = strrchr(base, '.');
+    *stem = strndup(base, dot ? (size_t)(dot - base) : strlen(base));
+    *dir = slash ? (slash == name ? strdup("/") : strndup(name, slash - name)) : strdup(".");
+    if (*stem == NULL || *dir == NULL) die("splitFilename: out of memory");
+}
+
+// the *.in files next to the buffer, the ones named after it if there are any
+static int testsFind(){
+    char *path, *stem;
+    splitFilename(&path, &stem);
+    size_t stemlen = strlen(stem);
+
+    DIR *d = opendir(path);
+    int n = 0, cap = 0, named = 0, pass;
+    R.tests = NULL;
+    // the first pass counts the tests named after the file
+    for (pass = 0; d && pass < 2; pass++){
+        struct dirent *ent;
+        rewinddir(d);
+        while ((ent = readdir(d)) != NULL){
+            size_t len = strlen(ent->d_name);
+            if (len < 4 || strcmp(ent->d_name + len - 3, ".in") != 0) continue;
+            int mine = strncmp(ent->d_name, stem, stemlen) == 0;
+            if (pass == 0){
+                named += mine;
+                continue;
+            }
+            if (named && !mine) continue;
+            if (n == cap){
+                cap = imax(16, cap*2);
+                R.tests = realloc(R.tests, sizeof(struct sampleTest)*cap);
+                if (R.tests == NULL) die("testsFind: out of memory");
+            }
+            struct sampleTest *t = &R.tests[n++];
+            memset(t, 0, sizeof(*t));
+            t->name = strdup(ent->d_name);
+            t->in = malloc(strlen(path) + len + 2);
+            sprintf(t->in, "%s/%s", path, ent->d_name);
+            t->out = malloc(strlen(t->in) + 2);
+            sprintf(t->out, "%.*s.out", (int)strlen(t->in) - 3, t->in);
+            if (access(t->out, R_OK) != 0){
+                free(t->out);
+                t->out = NULL;
+            }
+        }
+    }
+    if (d) closedir(d);
+    free(stem);
+    free(path);
+    if (n) qsort(R.tests, n, sizeof(struct sampleTest), testCompare);
+    R.ntests = n;
+    return n;
+}
+
+// run the sample tests against M.binary
+void testsStart(){
+    if (testsFind() == 0){
+        editorSetStatusMessage("No *.in files next to %s", E.filename ? E.filename : "the buffer");
+        return;
+    }
+    R.binary = strdup(M.binary);
+    atomic_store(&R.next, 0);
+    atomic_store(&R.cancel, 0);
+    R.nshown = 0;
+    M.ndiags = M.errors = M.next = 0;
+    paneClear();
+    int j;
+    for (j = 0; j < R.ntests; j++){
+        char line[128];
+        int len = snprintf(line, sizeof(line), "%-24.24s  ...", R.tests[j].name);
+        paneAppend(line, len, ATTR_NORMAL);
+    }
+    editorPaneShow(1);
+    clock_gettime(CLOCK_MONOTONIC, &R.start);
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = imax(1, imin(imin(ncpu, CPEDI_TEST_THREADS), R.ntests));
+    R.nthreads = 0;
+    for (j = 0; j < want; j++){
+        if (pthread_create(&R.threads[R.nthreads], NULL, testThread, NULL) == 0) R.nthreads++;
+    }
+    if (R.nthreads == 0) testThread(NULL); // no threads, run them here
+    R.running = 1;
+    editorSetStatusMessage("Running %d tests on %d threads...", R.ntests, imax(R.nthreads, 1));
+}
+
+static void testsFree(){
+    int j;
+    for (j = 0; j < R.ntests; j++){
+        free(R.tests[j].name);
+        free(R.tests[j].in);
+        free(R.tests[j].out);
+    }
+    free(R.tests);
+    R.tests = NULL;
+    R.ntests = 0;
+    free(R.binary);
+    R.binary = NULL;
+}
+
+// results of the tests that finished go to the pane
+void editorCheckTests(){
+    if (!R.running) return;
+    static const char *verdicts[] = {"...", "AC", "WA", "RAN", "TLE", "MLE", "RE", "FAIL"};
+    static const unsigned char attrs[] = {ATTR_NORMAL, ATTR_TYPE, ATTR_ERROR, ATTR_NORMAL,
+        ATTR_ERROR, ATTR_ERROR, ATTR_ERROR, ATTR_ERROR};
+    int j;
+    for (j = 0; j < R.ntests; j++){
+        struct sampleTest *t = &R.tests[j];
+        if (t->shown || !atomic_load(&t->done)) continue;
+        char line[128];
+        snprintf(line, sizeof(line), "%-24.24s  %-4s  %6.2fs cpu  %6.2fs wall  %8.1f MB",
+            t->name, verdicts[t->verdict], t->cpu, t->wall, t->rss/1024.0);
+        paneSet(j, line, attrs[t->verdict]);
+        t->shown = 1;
+        R.nshown++;
+    }
+    if (R.nshown < R.ntests) return;
+
+    for (j = 0; j < R.nthreads; j++) pthread_join(R.threads[j], NULL);
+    R.running = 0;
+    int passed = 0, first = -1;
+    double slowest = 0;
+    for (j = 0; j < R.ntests; j++){
+        int ok = R.tests[j].verdict == TEST_AC || R.tests[j].verdict == TEST_RAN;
+        passed += ok;
+        if (!ok && first == -1) first = j;
+        slowest = R.tests[j].cpu > slowest ? R.tests[j].cpu : slowest;
+    }
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - R.start.tv_sec) + (end.tv_nsec - R.start.tv_nsec)/1e9;
+    if (first == -1){
+        editorSetStatusMessage("All %d tests passed in %.2fs, slowest %.2fs cpu", R.ntests, secs, slowest);
+    } else {
+        editorSetStatusMessage("%d of %d tests passed, first failure: %s", passed, R.ntests, R.tests[first].name);
+    }
+    testsFree();
+}
+
+// kill the tests still running
+void testsStop(){
+    if (!R.running) return;
+    atomic_store(&R.cancel, 1);
+    int j;
+    for (j = 0; j < R.ntests; j++){
+        int pid = atomic_load(&R.tests[j].pid);
+        if (pid > 0) kill(pid, SIGKILL);
+    }
+    for (j = 0; j < R.nthreads; j++) pthread_join(R.threads[j], NULL);
+    R.running = 0;
+    testsFree();
+}
+
+// build the buffer if it changed, then run the sample tests
+void editorRunTests(){
+    if (R.running){
+        editorSetStatusMessage("Tests are still running");
+        return;
+    }
+    int built = editorCompile();
+    if (built == 2) testsStart();
+    else if (built == 1) M.then = testsStart;
+}
+
+/* Stress Test */
+
+// Ctrl-K builds the buffer along with gen and brute from next to the file,
+// then runs seed after seed on every core: the generator's output goes to
+// a memfd that the brute force and the buffer's binary both read, the
+// brute force answers into a second memfd and the binary's answer is
+// compared with it through a pipe as it comes out. The first seed that
+// fails is shown in the message pane and written next to the file as
+// <name>-stress.in and .out, where ^T picks it up.
+
+// path of name.cpp or name.c next to the buffer, NULL if neither is there
+static char *stressSource(const char *dir, const char *name){
+    static const char *exts[] = {".cpp", ".cc", ".c"};
+    size_t j;
+    for (j = 0; j < sizeof(exts)/sizeof(exts[0]); j++){
+        char *path = malloc(strlen(dir) + strlen(name) + 6);
+        if (path == NULL) die("stressSource: out of memory");
+        sprintf(path, "%s/%s%s", dir, name, exts[j]);
+        if (access(path, R_OK) == 0) return path;
+        free(path);
+    }
+    return NULL;
+}
+
+static void stressFail(const char *fmt, ...){
+    pthread_mutex_lock(&X.lock);
+    if (!X.why[0]){
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(X.why, sizeof(X.why), fmt, ap);
+        va_end(ap);
+    }
+    pthread_mutex_unlock(&X.lock);
+    atomic_store(&X.stop, 1);
+}
+
+// build a source file from disk through the compile cache, on this thread
+static char *stressBuild(const char *src){
+    FILE *fp = fopen(src, "r");
+    if (fp == NULL){
+        stressFail("Cannot read %s: %s", src, strerror(errno));
+        return NULL;
+    }
+    size_t len = 0, cap = 4096;
+    char *source = malloc(cap);
+    size_t n;
+    while (source && (n = fread(&source[len], 1, cap - len, fp)) > 0){
+        len += n;
+        if (len == cap) source = realloc(source, cap *= 2);
+    }
+    fclose(fp);
+    if (source == NULL) die("stressBuild: out of memory");
+
+    int argc, j;
+    char **argv = compileCommand(src, &argc);
+    char target[PATH_MAX];
+    compileTarget(argv, argc, source, len, target, sizeof(target));
+    if (access(target, X_OK) == 0){
+        for (j = 0; j < argc; j++) free(argv[j]);
+        free(argv);
+        free(source);
+        utimensat(AT_FDCWD, target, NULL, 0);
+        return strdup(target);
+    }
+    struct compileJob *job = compileJobNew(argv, argc, source, len, target);
+    pthread_mutex_lock(&X.lock);
+    X.job = job;
+    // ^K may have come before there was a job to cancel
+    if (atomic_load(&X.cancel)) atomic_store(&job->cancel, 1);
+    pthread_mutex_unlock(&X.lock);
+    compileThread(job);
+    pthread_mutex_lock(&X.lock);
+    X.job = NULL;
+    pthread_mutex_unlock(&X.lock);
+    int ok = job->ok && !atomic_load(&X.cancel);
+    if (!ok && !atomic_load(&X.cancel)){
+        // the first line says why, about the file rather than <stdin>
+        static const char stdinName[] = "<stdin>:";
+        size_t from = 0, end = 0;
+        if (job->outlen > sizeof(stdinName) && memcmp(job->out, stdinName, sizeof(stdinName)-1) == 0){
+            from = sizeof(stdinName)-1;
+        }
+        while (from + end < job->outlen && job->out[from + end] != '\n') end++;
+        stressFail("%s:%.*s", src, (int)end, job->out ? &job->out[from] : "");
+    }
+    compileFreeJob(job);
+    return ok ? strdup(target) : NULL;
+}
+
+// everything written to a memfd so far
+static char *stressSlurp(int fd, size_t *len){
+    struct stat st;
+    *len = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    char *s = malloc(*len + 1);
+    if (s == NULL) die("stressSlurp: out of memory");
+    size_t off = 0;
+    while (off < *len){
+        ssize_t n = pread(fd, &s[off], *len - off, off);
+        if (n <= 0) break;
+        off += n;
+    }
+    *len = off;
+    return s;
+}
+
+// run argv from in to out as the worker's current program, 1 if it exited cleanly
+static int stressStep(struct stressWorker *w, char *const argv[], int in, int out){
+    pid_t pid = spawnLimited(argv, in, out);
+    if (pid == -1) return 0;
+    atomic_store(&w->t.pid, pid);
+    int status;
+    struct rusage ru;
+    int waited = waitLimited(pid, monotonicSeconds() + 2*CPEDI_TEST_TIME + 1, &status, &ru);
+    atomic_store(&w->t.pid, 0);
+    return waited == 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void *stressWorker(void *arg){
+    struct stressWorker *w = arg;
+    static const char *verdicts[] = {"...", "AC", "wrong answer", "AC", "time limit exceeded",
+        "memory limit exceeded", "runtime error", "could not run"};
+    int in = memfd_create("cpedi-input", MFD_CLOEXEC);
+    int expect = memfd_create("cpedi-expected", MFD_CLOEXEC);
+    int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (in == -1 || expect == -1 || devnull == -1) stressFail("Cannot set up a worker: %s", strerror(errno));
+
+    while (!atomic_load(&X.stop) && !atomic_load(&X.cancel)){
+        int seed = atomic_fetch_add(&X.next, 1);
+        char arg[16];
+        snprintf(arg, sizeof(arg), "%d", seed);
+        char *gen[] = {X.gen, arg, NULL}, *brute[] = {X.brute, NULL};
+        const char *failed = NULL;
+
+        // each program starts reading its files from the top
+        ftruncate(in, 0);
+        lseek(in, 0, SEEK_SET);
+        ftruncate(expect, 0);
+        lseek(expect, 0, SEEK_SET);
+        if (!stressStep(w, gen, devnull, in)) failed = "the generator failed";
+        lseek(in, 0, SEEK_SET);
+        if (!failed && !stressStep(w, brute, in, expect)) failed = "the brute force failed";
+        lseek(in, 0, SEEK_SET);
+        lseek(expect, 0, SEEK_SET);
+        if (!failed){
+            w->t.verdict = TEST_RUNNING;
+            testRunOn(&w->t, X.binary, in, expect);
+            if (w->t.verdict != TEST_AC) failed = verdicts[w->t.verdict];
+        }
+        // killed by ^K, not a failure
+        if (atomic_load(&X.cancel)) break;
+        if (!failed){
+            atomic_fetch_add(&X.runs, 1);
+            continue;
+        }
+
+        // seeds below this one may still be running, the smallest failure wins
+        atomic_store(&X.stop, 1);
+        pthread_mutex_lock(&X.lock);
+        if (X.failed == -1 || seed < X.failed){
+            X.failed = seed;
+            snprintf(X.why, sizeof(X.why), "Seed %d: %s", seed, failed);
+            free(X.input);
+            free(X.expected);
+            X.input = stressSlurp(in, &X.inputlen);
+            X.expected = stressSlurp(expect, &X.expectedlen);
+        }
+        pthread_mutex_unlock(&X.lock);
+    }
+    if (in != -1) close(in);
+    if (expect != -1) close(expect);
+    if (devnull != -1) close(devnull);
+    atomic_fetch_sub(&X.live, 1);
+    return NULL;
+}
+
+static void *stressThread(void *arg){
+    (void)arg;
+    X.gen = stressBuild(X.gensrc);
+    X.brute = X.gen ? stressBuild(X.brutesrc) : NULL;
+    if (X.gen && X.brute && !atomic_load(&X.cancel)){
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        int want = imax(1, imin(ncpu, CPEDI_TEST_THREADS)), j;
+        X.start = monotonicSeconds();
+        atomic_store(&X.built, 1);
+        atomic_store(&X.live, want);
+        for (j = 0; j < want; j++){
+            if (pthread_create(&X.workers[X.nworkers].thread, NULL, stressWorker, &X.workers[X.nworkers]) == 0){
+                X.nworkers++;
+            } else {
+                atomic_fetch_sub(&X.live, 1);
+            }
+        }
+        if (X.nworkers == 0){
+            atomic_store(&X.live, 1);
+            stressWorker(&X.workers[0]);
+        }
+        // wake the main loop now and then to show the throughput
+        int naps = 0;
+        while (atomic_load(&X.live) > 0){
+            struct timespec nap = {0, 10000000};
+            nanosleep(&nap, NULL);
+            if (++naps % (CPEDI_STRESS_REPORT/10) == 0) editorWake();
+        }
+        for (j = 0; j < X.nworkers; j++) pthread_join(X.workers[j].thread, NULL);
+        X.secs = monotonicSeconds() - X.start;
+    }
+    atomic_store(&X.done, 1);
+    editorWake();
+    return NULL;
+}
+
+// run gen, brute and M.binary against each other
+void stressStart(){
+    if (X.running) return;
+    splitFilename(&X.dir, &X.stem);
+    X.gensrc = stressSource(X.dir, CPEDI_STRESS_GEN);
+    X.brutesrc = stressSource(X.dir, CPEDI_STRESS_BRUTE);
+    if (X.gensrc == NULL || X.brutesrc == NULL){
+        editorSetStatusMessage("Stress testing needs %s.cpp and %s.cpp in %s",
+            CPEDI_STRESS_GEN, CPEDI_STRESS_BRUTE, X.dir);
+        stressStop();
+        return;
+    }
+    X.binary = strdup(M.binary);
+    atomic_store(&X.next, 1);
+    atomic_store(&X.runs, 0);
+    atomic_store(&X.stop, 0);
+    atomic_store(&X.cancel, 0);
+    atomic_store(&X.built, 0);
+    atomic_store(&X.done, 0);
+    X.failed = -1;
+    X.why[0] = '\0';
+    X.nworkers = 0;
+    X.reported = 0;
+    memset(X.workers, 0, sizeof(X.workers));
+    if (pthread_create(&X.thread, NULL, stressThread, NULL) != 0){
+        editorSetStatusMessage("Cannot start the stress test");
+        stressStop();
+        return;
+    }
+    X.running = 1;
+    editorSetStatusMessage("Stress: building %s and %s...", CPEDI_STRESS_GEN, CPEDI_STRESS_BRUTE);
+}
+
+// kill what the workers are running, they wind down after that
+static void stressCancel(){
+    atomic_store(&X.cancel, 1);
+    int j;
+    pthread_mutex_lock(&X.lock);
+    if (X.job){
+        atomic_store(&X.job->cancel, 1);
+        int pid = atomic_load(&X.job->pid);
+        if (pid > 0) kill(pid, SIGTERM);
+    }
+    pthread_mutex_unlock(&X.lock);
+    for (j = 0; j < CPEDI_TEST_THREADS; j++){
+        int pid = atomic_load(&X.workers[j].t.pid);
+        if (pid > 0) kill(pid, SIGKILL);
     }
-    return buf;
 }
 
-void editorOpen(char *filename){
-    free(E.filename);
-    E.filename = strdup(filename); // duplicate the string
+// stop a stress run and forget it
+void stressStop(){
+    if (X.running){
+        stressCancel();
+        pthread_join(X.thread, NULL);
+        X.running = 0;
+    }
+    free(X.gensrc);
+    free(X.brutesrc);
+    free(X.gen);
+    free(X.brute);
+    free(X.binary);
+    free(X.dir);
+    free(X.stem);
+    free(X.input);
+    free(X.expected);
+    X.gensrc = X.brutesrc = X.gen = X.brute = X.binary = X.dir = X.stem = X.input = X.expected = NULL;
+}
 
-    FILE *fp = fopen(filename, "r");
-    if (!fp) die("editorOpen: Error while opening file");
-   
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen = 0;
-    while ((linelen = getline(&line, &linecap, fp))!=-1){
-        while (linelen > 0 && (line[linelen-1] == '\r' || line[linelen-1] == '\n'))
-        {
-            linelen--;
-        }
-        editorInsertRow(E.numrows, line, linelen);
-    }   
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
-    if (strcmp(E.filename,"cp/template.cpp")==0){
-        E.cy = 45;
-        editorScroll();
-        E.cy = 30;
-        E.cx = countDigits(E.numrows);   
-        editorInsertChar('\t');
+// write the failing case next to the file, returns the path of the input
+static char *stressSave(){
+    char *path = malloc(strlen(X.dir) + strlen(X.stem) + 16);
+    if (path == NULL) die("stressSave: out of memory");
+    sprintf(path, "%s/%s-stress.out", X.dir, X.stem);
+    FILE *fp = fopen(path, "w");
+    if (fp){
+        fwrite(X.expected, 1, X.expectedlen, fp);
+        fclose(fp);
     }
+    sprintf(path, "%s/%s-stress.in", X.dir, X.stem);
+    fp = fopen(path, "w");
+    if (fp == NULL || fwrite(X.input, 1, X.inputlen, fp) != X.inputlen){
+        if (fp) fclose(fp);
+        free(path);
+        return NULL;
+    }
+    fclose(fp);
+    return path;
 }
 
-void editorSave(int newFile){
-    if (E.filename == NULL || newFile) {
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)");
-        if (E.filename == NULL){
-            editorSetStatusMessage("Save aborted");
-            return;
+// the first lines of a failing case go to the pane under a heading, the
+// whole of it is in the saved files. Control characters show as spaces
+static void stressShow(const char *heading, const char *s, size_t len){
+    paneAppend(heading, strlen(heading), ATTR_KEYWORD);
+    size_t off = 0;
+    int n;
+    for (n = 0; n < CPEDI_STRESS_LINES && off < len; n++){
+        const char *nl = memchr(&s[off], '\n', len - off);
+        size_t end = nl ? (size_t)(nl - s) : len;
+        char *line = strndup(&s[off], end - off);
+        if (line == NULL) die("stressShow: out of memory");
+        char *c;
+        for (c = line; *c; c++){
+            if (iscntrl((unsigned char)*c)) *c = ' ';
         }
+        paneAppend(line, strlen(line), ATTR_NORMAL);
+        free(line);
+        off = end + 1;
     }
+}
 
-    int len;
-    char *buf = editorRowsToString(&len);
+// show the throughput, and the outcome once the run is over
+void editorCheckStress(){
+    if (!X.running) return;
+    if (!atomic_load(&X.done)){
+        double now = monotonicSeconds();
+        if (!atomic_load(&X.built) || now - X.reported < CPEDI_STRESS_REPORT/1000.0) return;
+        X.reported = now;
+        int runs = atomic_load(&X.runs);
+        editorSetStatusMessage("Stress: %d runs, %.0f/s on %d threads | ^K: stop",
+            runs, runs/(now - X.start), atomic_load(&X.live));
+        return;
+    }
+    pthread_join(X.thread, NULL);
+    X.running = 0;
+    int runs = atomic_load(&X.runs);
+    double rate = X.secs > 0 ? runs/X.secs : 0;
+    if (X.failed == -1){
+        if (X.why[0]) editorSetStatusMessage("%s", X.why);
+        else editorSetStatusMessage("Stress stopped after %d runs, %.0f/s", runs, rate);
+        stressStop();
+        return;
+    }
+    // the solution stays open with its cursor and undo, the case opens in
+    // the pane and waits on disk for ^T
+    char *path = stressSave();
+    char line[PATH_MAX + 64];
+    M.ndiags = M.errors = M.next = 0;
+    paneClear();
+    int len = snprintf(line, sizeof(line), "%s after %d runs", X.why, runs);
+    paneAppend(line, imin(len, sizeof(line)-1), ATTR_ERROR);
+    if (path) len = snprintf(line, sizeof(line), "saved as %s and its .out", path);
+    else len = snprintf(line, sizeof(line), "cannot save it next to the file");
+    paneAppend(line, imin(len, sizeof(line)-1), ATTR_NORMAL);
+    stressShow("input:", X.input, X.inputlen);
+    stressShow("expected output:", X.expected, X.expectedlen);
+    P.follow = 0;
+    P.top = 0;
+    editorPaneShow(1);
+    if (path) editorSetStatusMessage("%s after %d runs (%.0f/s), saved as %s", X.why, runs, rate, path);
+    else editorSetStatusMessage("%s after %d runs, cannot save the input", X.why, runs);
+    free(path);
+    stressStop();
+}
 
-    // Open or create the file with specified filename
-    // 0644 => Standard permission for textfiles (Owner gets rw other get r)
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1){
-        // sets the file's size to the specified length cut off extra data or add '0' bytes at the end 
-        if (ftruncate(fd, len) != -1){
-            if (write(fd, buf, len) == len){
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editorSetStatusMessage("%d File Saved Successfully!", len);
-                return;
-            }
-        } 
-        close(fd);
+// ^K builds the buffer if it changed and starts stress testing it, or stops it
+void editorStress(){
+    if (X.running){
+        stressCancel();
+        editorSetStatusMessage("Stopping the stress test...");
+        return;
     }
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    char *dir, *stem;
+    splitFilename(&dir, &stem);
+    char *gen = stressSource(dir, CPEDI_STRESS_GEN), *brute = stressSource(dir, CPEDI_STRESS_BRUTE);
+    if (gen && brute){
+        int built = editorCompile();
+        if (built == 2) stressStart();
+        else if (built == 1) M.then = stressStart;
+    } else {
+        editorSetStatusMessage("Stress testing needs %s.cpp and %s.cpp in %s",
+            CPEDI_STRESS_GEN, CPEDI_STRESS_BRUTE, dir);
+    }
+    free(gen);
+    free(brute);
+    free(dir);
+    free(stem);
 }
 
 /* Append Buffer */
@@ -584,12 +5239,260 @@ void abFree(struct abuf *ab){
     free(ab->b);
 }
 
+/* Screen */
+
+// The terminal is treated as a grid of cells. Drawing fills the back frame,
+// screenFlush() compares it with the front frame (what the terminal shows)
+// and only sends the cells that differ.
+
+void screenInit(){
+    S.rows = E.screenrows + 2;
+    S.cols = E.screencols;
+    S.front = malloc(sizeof(scell)*S.rows*S.cols);
+    S.back = malloc(sizeof(scell)*S.rows*S.cols);
+    S.dirty = malloc(E.screenrows);
+    if (!S.front || !S.back || !S.dirty) die("screenInit: out of memory");
+    S.rowoff = S.coloff = S.gutter = -1;
+    S.valid = 0;
+    S.scrolllen = 0;
+    // a dumb terminal gets a repaint of whatever moved
+    char *term = getenv("TERM");
+    S.canscroll = term && *term && strcmp(term, "dumb") != 0;
+    screenMarkAllDirty();
+}
+
+// repaint everything on the next refresh, e.g. after something else wrote to the terminal
+void screenInvalidate(){
+    S.valid = 0;
+    screenMarkAllDirty();
+}
+
+void screenMarkAllDirty(){
+    if (S.dirty) memset(S.dirty, 1, E.screenrows);
+}
+
+void screenMarkRowDirty(int filerow){
+    if (S.dirty == NULL) return;
+    int y = filerow - S.rowoff;
+    if (y >= 0 && y < E.screenrows) S.dirty[y] = 1;
+}
+
+// rows were inserted or deleted at filerow, everything below it moved
+void screenMarkRowsDirtyFrom(int filerow){
+    if (S.dirty == NULL) return;
+    int y = imax(0, filerow - S.rowoff);
+    if (y < E.screenrows) memset(&S.dirty[y], 1, E.screenrows - y);
+}
+
+static void shiftLines(scell *frame, int d, int n, int cols){
+    int k = abs(d);
+    if (d > 0){
+        memmove(frame, frame + k*cols, sizeof(scell)*(n-k)*cols);
+    } else {
+        memmove(frame + k*cols, frame, sizeof(scell)*(n-k)*cols);
+    }
+}
+
+// The view moved d lines down the file (up when negative). Lines that are
+// still visible keep what was drawn for them, only the exposed ones are
+// rebuilt. When the terminal has scroll regions it shifts its own copy
+// too, so the flush only has to paint the exposed lines.
+void screenScroll(int d){
+    int n = E.screenrows, k = abs(d), y;
+    shiftLines(S.back, d, n, S.cols);
+    if (d > 0){
+        memmove(S.dirty, S.dirty + k, n-k);
+        memset(S.dirty + n-k, 1, k);
+    } else {
+        memmove(S.dirty + k, S.dirty, n-k);
+        memset(S.dirty, 1, k);
+    }
+    if (!S.valid || !S.canscroll) return;
+
+    // <esc>[top;bottomr limits scrolling to the text lines so the bars stay,
+    // <esc>[nS scrolls the region up n lines, <esc>[nT down, <esc>[r resets the region
+    S.scrolllen = snprintf(S.scrollseq, sizeof(S.scrollseq), "\x1b[m\x1b[1;%dr\x1b[%d%c\x1b[r",
+        n, k, d > 0 ? 'S' : 'T');
+    shiftLines(S.front, d, n, S.cols);
+    for (y = (d > 0 ? n-k : 0); y < (d > 0 ? n : k); y++){
+        int x;
+        for (x = 0; x < S.cols; x++){
+            S.front[y*S.cols+x].ch = ' ';
+            S.front[y*S.cols+x].attr = ATTR_NORMAL;
+        }
+    }
+}
+
+// write len bytes of s to line y of the back frame starting at column x
+void screenPut(int y, int x, const char *s, int len, unsigned char attr){
+    scell *line = &S.back[y*S.cols];
+    int j;
+    for (j = 0; j < len && x+j < S.cols; j++){
+        line[x+j].ch = s[j];
+        line[x+j].attr = attr;
+    }
+}
+
+void screenFill(int y, int x, int to, char ch, unsigned char attr){
+    scell *line = &S.back[y*S.cols];
+    for (; x < to && x < S.cols; x++){
+        line[x].ch = ch;
+        line[x].attr = attr;
+    }
+}
+
+const char *screenAttrSGR(unsigned char attr){
+    switch (attr)
+    {
+        // <esc>[7m switches to inverted colours and <esc>[m switches back to normal
+        case ATTR_INVERSE: return "\x1b[0;7m";
+        // <esc>[30;43m is black on yellow
+        case ATTR_MATCH: return "\x1b[0;30;43m";
+        // <esc>[3Xm sets the foreground: 1 red, 2 green, 3 yellow, 4 blue, 5 magenta, 6 cyan
+        case ATTR_KEYWORD: return "\x1b[0;33m";
+        case ATTR_TYPE: return "\x1b[0;32m";
+        case ATTR_NUMBER: return "\x1b[0;31m";
+        case ATTR_STRING: return "\x1b[0;35m";
+        case ATTR_COMMENT: return "\x1b[0;36m";
+        case ATTR_PREPROC: return "\x1b[0;34m";
+        // <esc>[1;4m is bold and underlined
+        case ATTR_BRACKET: return "\x1b[0;1;4m";
+        case ATTR_ERROR: return "\x1b[0;31m";
+        default: return "\x1b[m";
+    }
+}
+
+static int cellEq(scell a, scell b){
+    return a.ch == b.ch && a.attr == b.attr;
+}
+
+// send the cells of the back frame that differ from the front frame
+void screenFlush(int cy, int cx){
+    struct abuf ab = ABUF_INIT;
+    int y, x;
+    if (!S.valid){
+        // <esc>[2J => clear entire screen, the front frame is then all blanks
+        abAppend(&ab, "\x1b[m\x1b[2J", 7);
+        for (x = 0; x < S.rows*S.cols; x++){
+            S.front[x].ch = ' ';
+            S.front[x].attr = ATTR_NORMAL;
+        }
+        S.valid = 1;
+    } else if (S.scrolllen){
+        abAppend(&ab, S.scrollseq, S.scrolllen);
+    }
+    S.scrolllen = 0;
+    // hide the cursor while printing, dropped again if nothing changed
+    int hide = ab.len;
+    abAppend(&ab, "\x1b[?25l", 6);
+    int start = ab.len;
+    int attr = -1; // current SGR state, unknown until we set one
+    int cursy = -1, cursx = -1; // where the terminal cursor is, -1 when unknown
+
+    for (y = 0; y < S.rows; y++){
+        scell *f = &S.front[y*S.cols], *b = &S.back[y*S.cols];
+        // the back line is blank from column blank onwards
+        int blank = S.cols;
+        while (blank > 0 && b[blank-1].ch == ' ' && b[blank-1].attr == ATTR_NORMAL) blank--;
+
+        // UTF-8 takes fewer columns than it has bytes, so past the first such
+        // character cells no longer match columns. A line with one in either
+        // frame is sent whole from column 0 when anything on it changed.
+        int bwide = 0, fwide = 0, same = 1;
+        for (x = 0; x < S.cols; x++){
+            bwide |= (unsigned char)b[x].ch >= 0x80;
+            fwide |= (unsigned char)f[x].ch >= 0x80;
+            same &= cellEq(f[x], b[x]);
+        }
+        if (bwide || fwide){
+            if (same) continue;
+            char buf[32];
+            int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y+1);
+            abAppend(&ab, buf, len);
+            for (x = 0; x < blank; x++){
+                if (b[x].attr != attr){
+                    const char *sgr = screenAttrSGR(b[x].attr);
+                    abAppend(&ab, sgr, strlen(sgr));
+                    attr = b[x].attr;
+                }
+                abAppend(&ab, &b[x].ch, 1);
+            }
+            if (attr != ATTR_NORMAL){
+                abAppend(&ab, "\x1b[m", 3);
+                attr = ATTR_NORMAL;
+            }
+            // a full line of one byte characters leaves nothing to erase
+            if (blank < S.cols || bwide) abAppend(&ab, "\x1b[K", 3);
+            memcpy(f, b, sizeof(scell)*S.cols);
+            cursy = cursx = -1;
+            continue;
+        }
+
+        x = 0;
+        while (x < S.cols){
+            if (cellEq(f[x], b[x])){
+                x++;
+                continue;
+            }
+            // a run of changed cells, short stretches of equal cells are resent
+            // because that is cheaper than moving the cursor again
+            int last = x, end = x;
+            while (end < S.cols && end - last <= CPEDI_RUN_GAP){
+                if (!cellEq(f[end], b[end])) last = end;
+                end++;
+            }
+            if (cursy != y || cursx != x){
+                char buf[32];
+                int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y+1, x+1);
+                abAppend(&ab, buf, len);
+            }
+            for (; x <= last; x++){
+                if (x >= blank){
+                    // rest of the line is empty, erase it in one go
+                    if (attr != ATTR_NORMAL){
+                        abAppend(&ab, "\x1b[m", 3);
+                        attr = ATTR_NORMAL;
+                    }
+                    abAppend(&ab, "\x1b[K", 3);
+                    for (; x < S.cols; x++) f[x] = b[x];
+                    break;
+                }
+                if (b[x].attr != attr){
+                    const char *sgr = screenAttrSGR(b[x].attr);
+                    abAppend(&ab, sgr, strlen(sgr));
+                    attr = b[x].attr;
+                }
+                abAppend(&ab, &b[x].ch, 1);
+                f[x] = b[x];
+            }
+            cursy = y;
+            cursx = x < S.cols ? x : -1; // the cursor does not move past the last column
+        }
+    }
+
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cy, cx);
+    if (ab.len == start){
+        // only the cursor moved
+        ab.len = hide;
+        abAppend(&ab, buf, len);
+    } else {
+        if (attr != ATTR_NORMAL) abAppend(&ab, "\x1b[m", 3);
+        abAppend(&ab, buf, len);
+        abAppend(&ab, "\x1b[?25h", 6);
+    }
+    editorWrite(ab.b, ab.len);
+    abFree(&ab);
+}
+
 /* Output */
 
 void editorScroll(){
-    E.rx = countDigits(E.numrows);
+    // rows below the viewport are loaded a screen ahead
+    editorLoadRowsUntil(E.rowoff + 2*E.screenrows);
+    E.rx = 0;
     if (E.cy < E.numrows){
-        E.rx = countDigits(E.numrows) + editorRowCxtoRx(&E.row[E.cy], (E.cx-countDigits(E.numrows)));
+        E.rx = editorRowCxtoRx(editorRowAt(E.cy), E.cx);
     }
 
     if (E.cy < E.rowoff){
@@ -599,34 +5502,43 @@ void editorScroll(){
         // As screenrows is 1 based indexing
         E.rowoff = E.cy - E.screenrows+1;
     }
-    if (E.rx-countDigits(E.numrows) < E.coloff){
-        E.coloff = E.rx-countDigits(E.numrows);
+    if (E.rx < E.coloff){
+        E.coloff = E.rx;
     } 
-    if (E.rx-countDigits(E.numrows) >= E.coloff + E.screencols){
-        E.coloff = E.rx-countDigits(E.numrows) - E.screencols+1;
+    // the gutter takes part of the width
+    int textcols = E.screencols - L.gutter;
+    if (E.rx >= E.coloff + textcols){
+        E.coloff = E.rx - textcols+1;
     }
 }
 
-void editorDrawLineNumber(struct abuf *ab, int line){
-    int dig = countDigits(E.numrows);
-    char num[dig+10];
-    int len = snprintf(num, sizeof(num), "\x1b[7m%d\x1b[m", line); // 4 + x + 3
-    while (len<dig+7)
-    {
-        // 0123456789(10)
-        memmove(&num[5], &num[4], len-4);
-        num[4] = ' ';
-        len++;
-    }
-    num[len] = '\0';
-    abAppend(ab, num, len);
+// right aligned in the gutter, digits are written from the right
+void editorDrawLineNumber(int y, int line){
+    char *p = L.num + L.gutter;
+    do {
+        *--p = '0' + line%10;
+        line /= 10;
+    } while (line > 0 && p > L.num);
+    memset(L.num, ' ', p - L.num);
+    screenPut(y, 0, L.num, L.gutter, ATTR_INVERSE);
+}
+
+void editorDrawBracket(int y, erow *row, int col){
+    int x = L.gutter + editorRowCxtoRx(row, col) - E.coloff;
+    if (x >= L.gutter && x < S.cols) S.back[y*S.cols + x].attr = ATTR_BRACKET;
 }
 
-void editorDrawRows(struct abuf *ab){
+// rebuild the text lines of the back frame that changed since the last frame
+void editorDrawRows(){
+    int gutter = L.gutter;
     int y;
+    // rows whose lexer state changed are marked before any of them is drawn
+    if (E.syntax) editorLexUntil(imin(E.rowoff + E.screenrows, E.numrows));
     for (y = 0; y < E.screenrows; y++){
+        if (!S.dirty[y]) continue;
         int filerow = y + E.rowoff;
-        if (y >= E.numrows){
+        screenFill(y, 0, S.cols, ' ', ATTR_NORMAL);
+        if (filerow >= E.numrows){
             if (E.numrows == 0 && y == 0){
                 char welcome[80];
                 int welcomelen = snprintf(welcome, sizeof(welcome), 
@@ -635,103 +5547,112 @@ void editorDrawRows(struct abuf *ab){
                 welcomelen = imin(welcomelen, E.screencols);
                 int padding = (E.screencols-welcomelen)/2;
                 if (padding){
-                    editorDrawLineNumber(ab, y+1);
-                    padding--;
-                    while (padding--)
-                    {
-                        abAppend(ab, " ", 1);
-                    }
+                    editorDrawLineNumber(y, y+1);
                 }
-                abAppend(ab, welcome, welcomelen);
+                screenPut(y, padding, welcome, welcomelen, ATTR_NORMAL);
             }
             else{
-                // abAppend(ab, "~", 1);
-                editorDrawLineNumber(ab, E.rowoff+y+1);
+                editorDrawLineNumber(y, E.rowoff+y+1);
             }
         } else {
-            int len = E.row[filerow].rsize - E.coloff;
+            erow *row = editorRowAt(filerow);
+            // prompts can draw in the middle of a transaction
+            if (row->stale) editorRenderRow(row);
+            int len = row->rsize - E.coloff;
             len = imax(0, len);
-            len = imin(len, E.screencols);
-            editorDrawLineNumber(ab, E.rowoff+y+1);
-            abAppend(ab, &E.row[filerow].render[E.coloff], len);
+            editorDrawLineNumber(y, E.rowoff+y+1);
+            screenPut(y, gutter, &editorRowRender(row)[imin(E.coloff, row->rsize)], len, ATTR_NORMAL);
+            unsigned char *hl = editorRowHighlight(filerow);
+            if (hl){
+                scell *line = &S.back[y*S.cols + gutter];
+                int x;
+                for (x = 0; x < len && gutter+x < S.cols; x++) line[x].attr = hl[E.coloff + x];
+            }
+            if (filerow == BP.orow) editorDrawBracket(y, row, BP.ocol);
+            if (filerow == BP.crow) editorDrawBracket(y, row, BP.ccol);
+            if (F.active) editorDrawMatches(y, row, filerow);
         }
-
-        abAppend(ab, "\x1b[K", 3);
-        abAppend(ab, "\r\n", 2);
+        S.dirty[y] = 0;
     }
 }
 
-void editorDrawStatusBar(struct abuf *ab){
-    // <esc>[7m switches to inverted colours and <esc>[m switches back to normal
-    abAppend(ab, "\x1b[7m", 4); 
-    char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), " %.20s - %d lines %s",
-        E.filename ? E.filename : "[No Name]", E.numrows, 
-        E.dirty ? "(modified)":"");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "R: %d C: %d",
-        E.cy+1, E.rx-countDigits(E.numrows)+1);
+void editorDrawStatusBar(){
+    int y = E.screenrows + 1;
+    char status[80], rstatus[80], progress[16] = "", saving[24] = "";
+    if (editorIndexing()){
+        snprintf(progress, sizeof(progress), " (%d%%)",
+            (int)(atomic_load(&E.index->scanned)*100/E.maplen));
+    }
+    if (E.save){
+        snprintf(saving, sizeof(saving), " (saving %d%%)",
+            E.save->total ? (int)(atomic_load(&E.save->written)*100/E.save->total) : 100);
+    }
+    int len = snprintf(status, sizeof(status), " %.20s - %d%s lines%s %s%s",
+        E.filename ? E.filename : "[No Name]", editorTotalRows(),
+        editorIndexing() || (!editorFullyLoaded() && (E.index == NULL || atomic_load(&E.index->failed))) ? "+" : "",
+        progress, E.dirty ? "(modified)":"", saving);
+    int brow;
+    char bc;
+    int rlen = editorUnbalanced(&brow, &bc)
+        ? snprintf(rstatus, sizeof(rstatus), "Unmatched %c on %d | R: %d C: %d", bc, brow+1, E.cy+1, E.rx+1)
+        : snprintf(rstatus, sizeof(rstatus), "R: %d C: %d", E.cy+1, E.rx+1);
     len = imin(len, E.screencols);
-    abAppend(ab, status, len);
-    while (len < E.screencols)
-    {
-        if (E.screencols - len - 1 == rlen){
-            abAppend(ab, rstatus, rlen);
-            len += rlen;
-        }
-        abAppend(ab, " " , 1);
-        len++;
+    screenFill(y, 0, S.cols, ' ', ATTR_INVERSE);
+    screenPut(y, 0, status, len, ATTR_INVERSE);
+    // right status ends one column before the edge
+    if (len + rlen < E.screencols){
+        screenPut(y, E.screencols - rlen - 1, rstatus, rlen, ATTR_INVERSE);
     }
-    abAppend(ab, "\x1b[m", 3);
 }
 
-void editorDrawMessageBar(struct abuf *ab, const int duration){
-    abAppend(ab, "\x1b[7m", 4); 
-    abAppend(ab, "\x1b[K", 3); // Clear the message bar
+void editorDrawMessageBar(const int duration){
+    int y = E.screenrows;
     int msglen = strlen(E.statusmsg);
     msglen = imin(msglen, E.screencols);
-    int len = 0;
-    while (len < E.screencols)
-    {
-        // draw message which is less than 5 second old
-        if (len == (E.screencols-msglen)/2 && time(NULL) - E.statusmsg_time < duration){
-            abAppend(ab, E.statusmsg, msglen);
-            len += msglen;
-        }
-        abAppend(ab, " " , 1);
-        len++;
+    screenFill(y, 0, S.cols, ' ', ATTR_INVERSE);
+    // draw message which is less than 5 second old
+    if (time(NULL) - E.statusmsg_time < duration){
+        screenPut(y, (E.screencols-msglen)/2, E.statusmsg, msglen, ATTR_INVERSE);
+    }
+}
+
+// the pane sits under the status bar
+void editorDrawPane(){
+    int y;
+    for (y = 0; y < P.rows; y++){
+        int sy = E.screenrows + 2 + y, line = P.top + y;
+        screenFill(sy, 0, S.cols, ' ', ATTR_NORMAL);
+        if (line >= P.n) continue;
+        unsigned char attr = line == P.mark ? ATTR_INVERSE : P.attrs[line];
+        screenPut(sy, 0, P.lines[line], strlen(P.lines[line]), attr);
     }
-   
-    abAppend(ab, "\r\n", 2);
 }
 
 void editorRefreshScreen(){
     editorScroll();
 
-    struct abuf ab = ABUF_INIT;
-    // Write 4 bytes out to the terminal. 
-    // \x1b is escape character (27 in decimal) => escape sequence => <esc>[
-    // <esc>[2J => clear entire screen , <esc>[1J => clear the screen up to where the cursor is, <esc>[0J or <esc>[J => would clear the screen from the cursor up to the end of the screen 
-    abAppend(&ab, "\x1b[?25l", 6); // to hide the cursor which printing
-    // abAppend(&ab, "\x1b[2J", 4);
-    // H command (Cursor Position) to position the cursor.
-    // <esc>[row;colH => default: <esc>[1;1H
-    abAppend(&ab, "\x1b[H", 3);
-
-    editorDrawRows(&ab);
-    editorDrawMessageBar(&ab, 5);
-    editorDrawStatusBar(&ab);
+    // a vertical move of less than a screen shifts the lines already drawn,
+    // anything else that moves every visible line invalidates all of them
+    int gutter = L.gutter;
+    int d = E.rowoff - S.rowoff;
+    if (S.coloff == E.coloff && S.gutter == gutter && d != 0 && abs(d) < E.screenrows){
+        screenScroll(d);
+        S.rowoff = E.rowoff;
+    } else if (S.rowoff != E.rowoff || S.coloff != E.coloff || S.gutter != gutter){
+        S.rowoff = E.rowoff;
+        S.coloff = E.coloff;
+        S.gutter = gutter;
+        screenMarkAllDirty();
+    }
 
-    char buf[32];
-    // Terminal uses 1 based indexing, poisition the cursor
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy-E.rowoff)+1, (E.rx-E.coloff)+1);
-    abAppend(&ab, buf, strlen(buf));
-    
-    abAppend(&ab, "\x1b[?25h",6); // to unhide the cursor after the printing is done
+    editorFindBlock();
+    editorDrawRows();
+    editorDrawMessageBar(5);
+    editorDrawStatusBar();
+    editorDrawPane();
 
-    // Write the buffer to the terminal
-    write(STDOUT_FILENO, ab.b, ab.len);
-    // free the buffer
-    abFree(&ab);
+    // Terminal uses 1 based indexing, poisition the cursor
+    screenFlush((E.cy-E.rowoff)+1, (L.gutter+E.rx-E.coloff)+1);
 }
 
 // variadic function, meaning it can take any number of arguments
@@ -745,7 +5666,8 @@ void editorSetStatusMessage(const char *fmt, ...){
 
 /* Input */
 
-char *editorPrompt(char *prompt){
+// callback, when given, sees the text after every key along with the key
+char *editorPrompt(char *prompt, void (*callback)(char *, int)){
     size_t bufsize = 128;
     char* buf = malloc(bufsize);
 
@@ -755,20 +5677,26 @@ char *editorPrompt(char *prompt){
     while (1)
     {
         editorSetStatusMessage(prompt, buf);
-        editorRefreshScreen();
+        editorCheckSave();
+        editorCheckCompile();
+        editorCheckTests();
+        if (!editorInputPending()) editorRefreshScreen();
 
         int c = editorReadKey();
         if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE){
             if (buflen != 0) buf[--buflen] = '\0';
         } else if (c == '\x1b'){
             editorSetStatusMessage("");
+            if (callback) callback(buf, c);
             free(buf);
             return NULL;
         } else if (c == '\r'){
             if (buflen != 0){
                 editorSetStatusMessage("");
+                if (callback) callback(buf, c);
                 return buf;
             }
+            continue; // the prompt stays open, so the callback must not see Enter
         } else if(!iscntrl(c) && c < 128){
             if (buflen == bufsize-1){
                 bufsize *= 2;
@@ -776,61 +5704,97 @@ char *editorPrompt(char *prompt){
             }
             buf[buflen++] = c;
             buf[buflen] = '\0';
+        } else if (c == PASTE_KEY){
+            // a prompt is one line, keep the printable part
+            size_t j;
+            for (j = 0; j < I.pastelen; j++){
+                if (iscntrl((unsigned char)I.paste[j]) || (unsigned char)I.paste[j] >= 128) continue;
+                if (buflen == bufsize-1){
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = I.paste[j];
+            }
+            buf[buflen] = '\0';
         }
+        if (callback) callback(buf, c);
     }
     
 }
 
 void editorMoveCursor(int key){
-    erow *row = (E.cy >= E.numrows) ? NULL: &E.row[E.cy];
+    erow *row = (E.cy >= E.numrows) ? NULL: editorRowAt(E.cy);
 
     switch (key)
     {
     case ARROW_LEFT:
-        if ((E.cx-countDigits(E.numrows)) != 0) E.cx--;
+        if (E.cx != 0) E.cx--;
         else if (E.cy > 0){
             E.cy--;
-            E.cx = countDigits(E.numrows) + E.row[E.cy].size;
+            E.cx = editorRowAt(E.cy)->size;
         }
         break;
     case ARROW_RIGHT:
-        if (row && (E.cx-countDigits(E.numrows)) < row->size){
+        if (row && E.cx < row->size){
             E.cx++;
         } else if (E.cy+1 < E.numrows) {
-            E.cx = countDigits(E.numrows);
+            E.cx = 0;
             editorMoveCursor(ARROW_DOWN);
         }
         break;
     case ARROW_UP:
-        if (E.cy != 0) E.cy--;
-        break;
     case ARROW_DOWN:
-        if (E.cy < E.numrows-1) E.cy++;
+        if (key == ARROW_DOWN){
+            // loading can grow E.row or move its gap, row has to be looked up again
+            editorLoadRowsUntil(E.cy+2);
+            row = (E.cy >= E.numrows) ? NULL: editorRowAt(E.cy);
+        }
+        if (row == NULL){
+            if (key == ARROW_UP && E.cy != 0) E.cy--;
+            break;
+        }
+        // stay in the same screen column across rows with different tabs
+        int rx = editorRowCxtoRx(row, E.cx);
+        if (key == ARROW_UP && E.cy != 0) E.cy--;
+        if (key == ARROW_DOWN && E.cy < E.numrows-1) E.cy++;
+        E.cx = editorRowRxtoCx(editorRowAt(E.cy), rx);
         break;
     }
 
-    E.cx = countDigits(E.numrows) + imin((E.cx-countDigits(E.numrows)), getRowLength());
+    E.cx = imin(E.cx, getRowLength());
 }
 
 void editorProcessKeypress(){
     static int quit_times = CPEDI_QUIT_TIMES;
 
     int c = editorReadKey();
+    if (c == NO_KEY) return;
+    size_t allocs = E.arena.allocs;
 
+    // all edits of one key are one transaction, touched rows are rendered once
+    editorBeginEdit();
     switch (c)  
     {
         case '\r':
             editorInsertNewLine();
             break;
         case CTRL_KEY('q'):
+            // the save decides whether there are unsaved changes
+            if (E.save){
+                editorSetStatusMessage("Finishing save...");
+                editorRefreshScreen();
+                editorSaveFinish();
+            }
             if (E.dirty && quit_times > 0){
                 editorSetStatusMessage("WARNING!!! File has unsaved changes. "
                      "Press Ctrl-Q %d more times to quit.", quit_times);
                 quit_times--;
+                editorCommitEdit();
                 return;
             }
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
+            editorCloseBuffer();
             exit(0);
             break;
 
@@ -845,17 +5809,46 @@ void editorProcessKeypress(){
         case CTRL_KEY('d'):
             editorTeleport();
             break;
+
+        case CTRL_KEY('f'):
+            editorFind();
+            break;
+
+        case CTRL_KEY('r'):
+            editorReplaceAll();
+            break;
+
+        case CTRL_KEY('b'):
+            editorJumpBracket();
+            break;
+
+        case CTRL_KEY('n'):
+            editorComplete();
+            break;
+
+        case CTRL_KEY('z'):
+            editorUndo();
+            break;
+
+        case CTRL_KEY('y'):
+            editorRedo();
+            break;
         
         case CTRL_KEY('a'):
             editorCopyAll();
             break;
+
+        case CTRL_KEY('p'):
+            editorSetStatusMessage("Row allocs: open %zu, last key %zu, live %zu | %d slabs, %zu mallocs",
+                E.openallocs, E.keyallocs, E.arena.allocs - E.arena.frees, E.arena.nslabs, E.arena.mallocs);
+            break;
         
         case CTRL_KEY('x'):
-            if (E.numrows > 0){
-                editorCopyRow(E.cy);
-                editorDelRow(E.cy);
-                E.cx = countDigits(E.numrows);
-            }
+            editorCutRow();
+            break;
+
+        case CTRL_KEY('v'):
+            editorYank();
             break;
             
         case ARROW_UP:
@@ -867,26 +5860,22 @@ void editorProcessKeypress(){
 
         case PAGE_UP:
         case PAGE_DOWN:
-            {
-                if (c == PAGE_UP){
-                    E.cy = E.rowoff;
-                } else if (c == PAGE_DOWN){
-                    E.cy = E.rowoff + E.screenrows - 1;
-                    E.cy = imin(E.cy, E.numrows);
-                }
-                int times = E.screenrows;
-                while (times--)
-                {
-                    editorMoveCursor(c == PAGE_UP ? ARROW_UP: ARROW_DOWN);
-                }
-                break;
+            // a screen up or down from the edge of the view, in one step
+            if (c == PAGE_UP){
+                E.cy = imax(0, E.rowoff - E.screenrows);
+            } else {
+                editorLoadRowsUntil(E.rowoff + 2*E.screenrows + 1);
+                E.cy = imin(E.rowoff + E.screenrows - 1, E.numrows);
+                if (E.cy < E.numrows-1) E.cy = imin(E.cy + E.screenrows, E.numrows-1);
             }
+            E.cx = imin(E.cx, getRowLength());
+            break;
         
         case HOME_KEY:
-            E.cx = countDigits(E.numrows);
+            E.cx = 0;
             break;
         case END_KEY:
-            E.cx = countDigits(E.numrows) + getRowLength();
+            E.cx = getRowLength();
             break;
 
         case BACKSPACE:
@@ -900,8 +5889,32 @@ void editorProcessKeypress(){
             editorDelChar();
             break;
 
+        case PASTE_KEY:
+            editorInsertText(I.paste, I.pastelen);
+            break;
+
         case CTRL_KEY('l'):
+            screenInvalidate();
+            break;
+
         case '\x1b':
+            editorPaneShow(0);
+            break;
+
+        case CTRL_KEY('e'):
+            editorCompile();
+            break;
+
+        case CTRL_KEY('g'):
+            editorNextDiagnostic();
+            break;
+
+        case CTRL_KEY('t'):
+            editorRunTests();
+            break;
+
+        case CTRL_KEY('k'):
+            editorStress();
             break;
 
         case '"':
@@ -932,13 +5945,22 @@ void editorProcessKeypress(){
             break;
     }
 
+    editorCommitEdit();
     quit_times = CPEDI_QUIT_TIMES;
-
+    if (c != CTRL_KEY('p')) E.keyallocs = E.arena.allocs - allocs;
+    if (c != CTRL_KEY('x')){
+        K.append = 0;
+        clipboardFlush();
+    }
+    if (c != CTRL_KEY('v')) K.yank = -1;
+    editorSuggest((!iscntrl(c) && c < 128) || c == BACKSPACE || c == CTRL_KEY('h') || c == DEL_KEY);
 }
 
 /* Init */
 
 void initEditor(){
+    if (pipe2(I.wake, O_NONBLOCK | O_CLOEXEC) == -1) I.wake[0] = I.wake[1] = -1;
+    I.woken = 0;
     E.cx = 0;
     E.cy = 0;
     E.rx = 0;
@@ -947,7 +5969,30 @@ void initEditor(){
     E.numrows = 0;
     E.dirty = 0;
     E.row = NULL;
+    E.rowcap = 0;
+    E.rowgap = 0;
     E.filename = NULL;
+    editorSelectSyntax();
+    E.map = NULL;
+    E.maplen = 0;
+    E.mapoff = 0;
+    E.mapline = 0;
+    E.index = NULL;
+    E.indexseen = 0;
+    E.txdepth = 0;
+    undoClear();
+    K.helper = -1;
+    K.fd = -1;
+    K.yank = -1;
+    P.mark = -1;
+    pthread_mutex_init(&X.lock, NULL);
+    // a clipboard helper that exits early must not take the editor with it
+    signal(SIGPIPE, SIG_IGN);
+    E.save = NULL;
+    E.graveyard = NULL;
+    E.ngrave = E.gravecap = 0;
+    memset(&E.arena, 0, sizeof(struct rowArena));
+    E.openallocs = E.keyallocs = 0;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
 
@@ -955,13 +6000,275 @@ void initEditor(){
         die("initEditor: getWindowSize failed to get size of terminal");
     }
     E.screenrows -= 2; // Room for status bar at the bottom
-    E.cx = E.rx = countDigits(E.screenrows);
+    layoutInit(E.screenrows);
+    screenInit();
+}
+
+/* Benchmark */
+
+// Built with -DCPEDI_BENCH the editor runs without a terminal: keys come
+// from a script, frames go to the counting sink in H, and each key is
+// timed from being read to its frame being flushed. Without a script the
+// standard workloads run on a generated file. Allocations are counted by
+// replacing malloc, which glibc allows a program to do.
+#if defined(CPEDI_BENCH)
+
+void *__libc_malloc(size_t n);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *p, size_t n);
+void __libc_free(void *p);
+
+static atomic_long benchAllocs;
+
+void *malloc(size_t n){
+    atomic_fetch_add_explicit(&benchAllocs, 1, memory_order_relaxed);
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size){
+    atomic_fetch_add_explicit(&benchAllocs, 1, memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n){
+    atomic_fetch_add_explicit(&benchAllocs, 1, memory_order_relaxed);
+    return __libc_realloc(p, n);
+}
+
+void free(void *p){
+    __libc_free(p);
+}
+
+// what one workload measured, an op is one key or one open
+struct benchStats
+{
+    const char *name;
+    double *secs;
+    int n, cap;
+    size_t bytes;
+    int frames;
+    long allocs;
+};
+
+struct benchMark
+{
+    double t;
+    size_t bytes;
+    int frames;
+    long allocs;
+};
+
+static struct benchMark benchNow(){
+    struct benchMark m = {monotonicSeconds(), H.bytes, H.writes, atomic_load(&benchAllocs)};
+    return m;
+}
+
+static void benchRecord(struct benchStats *st, struct benchMark from){
+    struct benchMark to = benchNow();
+    if (st->n == st->cap){
+        st->cap = imax(64, st->cap*2);
+        st->secs = realloc(st->secs, sizeof(double)*st->cap);
+        if (st->secs == NULL) die("benchRecord: out of memory");
+    }
+    st->secs[st->n++] = to.t - from.t;
+    st->bytes += to.bytes - from.bytes;
+    st->frames += to.frames - from.frames;
+    st->allocs += to.allocs - from.allocs;
+}
+
+static int benchCompare(const void *a, const void *b){
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void benchHeader(){
+    printf("%-8s %7s %10s %10s %10s %10s %12s %10s\n",
+        "workload", "ops", "p50 us", "p90 us", "p99 us", "max us", "bytes/frame", "allocs/op");
+}
+
+static void benchReport(struct benchStats *st){
+    if (st->n == 0) return;
+    qsort(st->secs, st->n, sizeof(double), benchCompare);
+    double *s = st->secs;
+    int n = st->n;
+    printf("%-8s %7d %10.1f %10.1f %10.1f %10.1f %12.0f %10.1f\n", st->name, n,
+        s[(n-1)/2]*1e6, s[(int)((n-1)*0.9)]*1e6, s[(int)((n-1)*0.99)]*1e6, s[n-1]*1e6,
+        st->frames ? (double)st->bytes/st->frames : 0.0, (double)st->allocs/n);
+    free(st->secs);
+    st->secs = NULL;
+    st->n = st->cap = 0;
+    // the next workload reusing st starts from nothing
+    st->bytes = 0;
+    st->frames = 0;
+    st->allocs = 0;
+}
+
+// wait for background indexing so it does not land on the next workload
+static void benchSettle(){
+    while (editorIndexPending()){
+        struct timespec nap = {0, 1000000};
+        nanosleep(&nap, NULL);
+        editorIndexChanged();
+    }
+    editorRefreshScreen();
+}
+
+// feed keys to the editor one at a time, each one drawn and timed
+static void benchKeys(struct benchStats *st, const char *keys, size_t len){
+    H.keys = keys;
+    H.keylen = len;
+    while (editorInputPending()){
+        struct benchMark m = benchNow();
+        editorProcessKeypress();
+        editorScroll();
+        editorRefreshScreen();
+        // a save is done once the file is on disk
+        if (E.save) editorSaveFinish();
+        benchRecord(st, m);
+    }
+}
+
+static void benchOpen(struct benchStats *st, char *path){
+    editorCloseBuffer();
+    struct benchMark m = benchNow();
+    editorOpen(path);
+    editorRefreshScreen();
+    benchRecord(st, m);
+    benchSettle();
+}
+
+// keys of a workload, count copies of piece with prefix and suffix around each
+static char *benchScript(const char *prefix, const char *piece, const char *suffix, int count, size_t *len){
+    size_t p = strlen(prefix), c = strlen(piece), x = strlen(suffix);
+    char *s = malloc((p + c + x)*count + 1);
+    if (s == NULL) die("benchScript: out of memory");
+    int j;
+    *len = 0;
+    for (j = 0; j < count; j++){
+        memcpy(&s[*len], prefix, p);
+        memcpy(&s[*len + p], piece, c);
+        memcpy(&s[*len + p + c], suffix, x);
+        *len += p + c + x;
+    }
+    return s;
+}
+
+static void benchSuite(int lines){
+    char dir[] = "/tmp/cpedi-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL) die("benchSuite: mkdtemp");
+    char path[sizeof(dir) + 16];
+    snprintf(path, sizeof(path), "%s/bench.cpp", dir);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) die("benchSuite: fopen");
+    int j;
+    for (j = 0; j < lines; j++){
+        if (j % 10 == 0) fprintf(fp, "// block %d\n", j/10);
+        else fprintf(fp, "    long long v%d = f(%d, \"s%d\") * (v%d + %d); \n", j, j, j % 97, j-1, j % 13);
+    }
+    fclose(fp);
+
+    printf("cpedi %s, %dx%d screen, %d line file\n", CPEDI_VERSION, H.rows, H.cols, lines);
+    benchHeader();
+    struct benchStats st = {0};
+    size_t len;
+    char *keys;
+
+    st.name = "open";
+    for (j = 0; j < 5; j++) benchOpen(&st, path);
+    benchReport(&st);
+
+    st.name = "type";
+    editorTeleportTo(E.numrows/2);
+    keys = benchScript("", "for (int i = 0; i < n; i++) sum += a[i];", "\r", 50, &len);
+    benchKeys(&st, keys, len);
+    free(keys);
+    benchReport(&st);
+
+    st.name = "paste";
+    char block[64*48];
+    block[0] = '\0';
+    for (j = 0; j < 64; j++) strcat(block, "    total += cost[i][j] * weight(i, j);\n");
+    keys = benchScript("\x1b[200~", block, "\x1b[201~", 100, &len);
+    benchKeys(&st, keys, len);
+    free(keys);
+    benchReport(&st);
+
+    st.name = "scroll";
+    editorTeleportTo(1);
+    keys = benchScript("", "\x1b[6~", "", 500, &len);
+    benchKeys(&st, keys, len);
+    free(keys);
+    keys = benchScript("", "\x1b[B", "", 2000, &len);
+    benchKeys(&st, keys, len);
+    free(keys);
+    keys = benchScript("", "\x1b[5~", "", 500, &len);
+    benchKeys(&st, keys, len);
+    free(keys);
+    benchReport(&st);
+
+    st.name = "save";
+    for (j = 0; j < 5; j++) benchKeys(&st, "\x13", 1);
+    benchReport(&st);
+
+    editorCloseBuffer();
+    unlink(path);
+    rmdir(dir);
+}
+
+// replay the keys in script on file and report them as one workload
+static void benchReplay(const char *script, char *file){
+    int fd = open(script, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) die("benchReplay: cannot open the script");
+    char *keys = malloc(st.st_size + 1);
+    if (keys == NULL) die("benchReplay: out of memory");
+    ssize_t len = read(fd, keys, st.st_size);
+    close(fd);
+    if (len < 0) die("benchReplay: cannot read the script");
+    benchHeader();
+    if (file){
+        struct benchStats open = {"open", NULL, 0, 0, 0, 0, 0};
+        benchOpen(&open, file);
+        benchReport(&open);
+    }
+    struct benchStats keyst = {"keys", NULL, 0, 0, 0, 0, 0};
+    benchKeys(&keyst, keys, len);
+    benchReport(&keyst);
+    free(keys);
+}
+
+int main(int argc, char* argv[]){
+    const char *size = CPEDI_BENCH_SIZE, *script = NULL;
+    int lines = CPEDI_BENCH_LINES, opt;
+    while ((opt = getopt(argc, argv, "s:l:r:")) != -1){
+        switch (opt)
+        {
+            case 's': size = optarg; break;
+            case 'l': lines = atoi(optarg); break;
+            case 'r': script = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-s ROWSxCOLS] [-l LINES] [-r SCRIPT [FILE]]\n", argv[0]);
+                return 1;
+        }
+    }
+    H.on = 1;
+    if (sscanf(size, "%dx%d", &H.rows, &H.cols) != 2 || H.rows < 3 || H.cols < 1){
+        fprintf(stderr, "bad screen size %s\n", size);
+        return 1;
+    }
+    initEditor();
+    if (script) benchReplay(script, optind < argc ? argv[optind] : NULL);
+    else benchSuite(imax(lines, 1));
+    return 0;
 }
 
+#else
+
 int main(int argc, char* argv[]){
     system("clear");
     enableRawMode();
     initEditor();
+    compileCacheSweep();
     if (argc >= 2){
         editorOpen(argv[1]);
     }
@@ -970,9 +6277,19 @@ int main(int argc, char* argv[]){
 
     while (1)
     {
+        editorCheckSave();
+        editorCheckCompile();
+        editorCheckTests();
+        editorCheckStress();
         editorRefreshScreen();
-        editorProcessKeypress();
+        // apply every key that already arrived before drawing again
+        do {
+            editorProcessKeypress();
+            editorScroll(); // keys like PAGE_DOWN depend on where the view is
+        } while (editorInputPending());
     }
     
     return 0;
 }
+
+#endif